@@ -0,0 +1,266 @@
+#pragma once
+
+#include "kgp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/*
+ * Terminal driven animation. Every frame is compressed once, spread over all cores, and
+ * uploaded as a frame of a single image (a=f). After that the terminal plays them on its
+ * own (a=a,s=3), so steady state playback costs no client CPU and no pty bandwidth.
+ *
+ * Frames after the first only carry the bounding box of the pixels that changed since
+ * the previous frame and are composed onto a copy of it (c=, X=1); frames identical to
+ * their predecessor are folded into its gap.
+ *
+ * Frames can be added in batches while earlier ones are already on the terminal:
+ * upload() sends whatever was added since the last call and then drops the compressed
+ * data, and play_loading() lets the terminal run ahead and wait for the rest.
+ *
+ * Terminals without animation support (Ghostty) can still be driven from the client with
+ * show(), which only sends the frame number.
+ */
+class KittyAnimation {
+public:
+    // gap used for frames whose delay is 0, like browsers do
+    static constexpr int DEFAULT_GAP_MS = 100;
+
+    struct Frame {
+        std::vector<uint8_t> data; // zlib compressed RGBA of the changed rectangle
+        int x = 0;
+        int y = 0;
+        int w = 0; // 0: identical to the previous frame
+        int h = 0;
+        int gap_ms = 0;
+    };
+
+    KittyAnimation(int width, int height, int level = Z_BEST_COMPRESSION)
+        : m_width(width), m_height(height), m_level(level) {}
+
+    // `pixels` holds `count` top-down RGBA frames of `width` x `height` back to back,
+    // `delays_ms` the time each one stays on screen.
+    KittyAnimation(int width, int height, const uint8_t *pixels, size_t count,
+                   const int *delays_ms, int level = Z_BEST_COMPRESSION)
+        : KittyAnimation(width, height, level) {
+        add_frames(pixels, count, delays_ms);
+    }
+
+    KittyAnimation(const KittyAnimation &) = delete;
+    KittyAnimation &operator=(const KittyAnimation &) = delete;
+
+    // Compresses `count` more frames, laid out as for the constructor. The first one is
+    // diffed against `previous`, the last frame of the batch before (nullptr for the
+    // first batch).
+    auto add_frames(const uint8_t *pixels, size_t count, const int *delays_ms,
+                    const uint8_t *previous = nullptr) -> void {
+        assert(previous || m_gaps.empty());
+        const size_t first = m_pending.size();
+        m_pending.resize(first + count);
+        encode(pixels, count, delays_ms, previous, m_pending.data() + first);
+
+        // fold frames that changed nothing into the gap of the one before
+        size_t kept = first;
+        for (size_t i = first; i < m_pending.size(); i++) {
+            Frame &frame = m_pending[i];
+            if (frame.w == 0 && !m_gaps.empty()) {
+                m_gaps.back() += frame.gap_ms;
+                if (kept > 0)
+                    m_pending[kept - 1].gap_ms += frame.gap_ms;
+                else
+                    m_gap_changed = true; // the frame before is on the terminal already
+                continue;
+            }
+            m_gaps.push_back(frame.gap_ms);
+            m_encoded_size += frame.data.size();
+            if (kept++ != i)
+                m_pending[kept - 1] = std::move(frame);
+        }
+        m_pending.resize(kept);
+    }
+
+    // Frames left after folding identical ones.
+    [[nodiscard]] auto frame_count() const -> size_t {
+        return m_gaps.size();
+    }
+
+    // Compressed bytes of all frames together.
+    [[nodiscard]] auto encoded_size() const -> size_t {
+        return m_encoded_size;
+    }
+
+    [[nodiscard]] auto image() -> KittyImage & {
+        return m_image;
+    }
+
+    // Transmits the frames added since the last call; the first call also places the
+    // image at the cursor. Their compressed data is released afterwards.
+    auto upload(KittyWriter &writer = kitty_writer()) -> void {
+        char cmd[160];
+        int n;
+        if (m_gap_changed) {
+            // a folded frame lengthened the last frame already sent
+            n = std::snprintf(cmd, sizeof(cmd), "a=a,i=%u,r=%zu,z=%d,q=2", m_image.id(),
+                              m_sent, m_gaps[m_sent - 1]);
+            writer.send({cmd, static_cast<size_t>(n)});
+            m_gap_changed = false;
+        }
+
+        for (const Frame &frame : m_pending) {
+            if (m_sent == 0) {
+                n = std::snprintf(cmd, sizeof(cmd), "%s,q=2,o=z,f=32,s=%d,v=%d",
+                                  m_image.upload_keys(), m_width, m_height);
+                writer.send({cmd, static_cast<size_t>(n)}, frame.data.data(),
+                            frame.data.size());
+                // the root frame has no gap of its own until one is set
+                n = std::snprintf(cmd, sizeof(cmd), "a=a,i=%u,r=1,z=%d,q=2",
+                                  m_image.id(), frame.gap_ms);
+                writer.send({cmd, static_cast<size_t>(n)});
+            } else {
+                // frame m_sent + 1 starts as a copy of frame m_sent, the rectangle
+                // replaces its pixels
+                n = std::snprintf(cmd, sizeof(cmd),
+                                  "a=f,i=%u,q=2,c=%zu,X=1,o=z,f=32,"
+                                  "x=%d,y=%d,s=%d,v=%d,z=%d",
+                                  m_image.id(), m_sent, frame.x, frame.y, frame.w,
+                                  frame.h, frame.gap_ms);
+                writer.send({cmd, static_cast<size_t>(n)}, frame.data.data(),
+                            frame.data.size());
+            }
+            m_sent++;
+        }
+        m_pending.clear();
+        m_pending.shrink_to_fit();
+        writer.flush();
+    }
+
+    // Lets the terminal loop the animation, `loops` times or forever when 0.
+    auto play(int loops = 0, KittyWriter &writer = kitty_writer()) -> void {
+        // v=1 loops forever, v=n plays n - 1 loops
+        control(writer, "s=3,v=%d", loops > 0 ? loops + 1 : 1);
+    }
+
+    // Runs the animation while frames are still being added: at the last frame the
+    // terminal waits for more instead of looping. Call play() once all are uploaded.
+    auto play_loading(KittyWriter &writer = kitty_writer()) -> void {
+        control(writer, "s=2");
+    }
+
+    auto stop(KittyWriter &writer = kitty_writer()) -> void {
+        control(writer, "s=1");
+    }
+
+    // Client driven playback: makes `index` the current frame.
+    auto show(size_t index, KittyWriter &writer = kitty_writer()) -> void {
+        control(writer, "c=%zu", index + 1);
+    }
+
+    [[nodiscard]] auto gap_ms(size_t index) const -> int {
+        return m_gaps[index];
+    }
+
+private:
+    template <typename... Args>
+    auto control(KittyWriter &writer, const char *keys, Args... args) -> void {
+        char cmd[64];
+        int n = std::snprintf(cmd, sizeof(cmd), "a=a,i=%u,q=2,", m_image.id());
+        n += std::snprintf(cmd + n, sizeof(cmd) - n, keys, args...);
+        writer.send({cmd, static_cast<size_t>(n)});
+        writer.flush();
+    }
+
+    auto encode(const uint8_t *pixels, size_t count, const int *delays_ms,
+                const uint8_t *previous, Frame *out) const -> void {
+        const size_t frame_size = static_cast<size_t>(m_width) * m_height * 4;
+
+        // frames are independent once the previous one is known, so each worker takes
+        // the next unclaimed frame until none are left
+        std::atomic<size_t> next = 0;
+        auto work = [&] {
+            std::vector<uint8_t> region;
+            for (size_t i = next++; i < count; i = next++) {
+                const uint8_t *frame = pixels + i * frame_size;
+                Frame &result = out[i];
+                result.gap_ms =
+                    delays_ms && delays_ms[i] > 0 ? delays_ms[i] : DEFAULT_GAP_MS;
+                if (!changed_rect(i > 0 ? frame - frame_size : previous, frame, result))
+                    continue;
+                region.resize(static_cast<size_t>(result.w) * result.h * 4);
+                for (int row = 0; row < result.h; row++)
+                    std::memcpy(region.data() + static_cast<size_t>(row) * result.w * 4,
+                                frame + ((static_cast<size_t>(result.y) + row) * m_width +
+                                         result.x) * 4,
+                                static_cast<size_t>(result.w) * 4);
+                uLongf size = compressBound(region.size());
+                result.data.resize(size);
+                if (compress2(result.data.data(), &size, region.data(), region.size(),
+                              m_level) != Z_OK) {
+                    std::cerr << "Failed to compress animation frame " << i << "\n";
+                    std::exit(EXIT_FAILURE);
+                }
+                result.data.resize(size);
+            }
+        };
+        const size_t workers =
+            std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < workers; i++)
+            threads.emplace_back(work);
+        work();
+        for (auto &thread : threads)
+            thread.join();
+    }
+
+    // Bounding box of the pixels of `frame` that differ from `previous` (the whole frame
+    // when there is none). Returns false if nothing changed.
+    auto changed_rect(const uint8_t *previous, const uint8_t *frame, Frame &out) const
+        -> bool {
+        if (!previous) {
+            out.x = out.y = 0;
+            out.w = m_width;
+            out.h = m_height;
+            return true;
+        }
+        const size_t stride = static_cast<size_t>(m_width) * 4;
+        int top = m_height, bottom = -1, left = m_width, right = -1;
+        for (int y = 0; y < m_height; y++) {
+            const uint8_t *a = previous + y * stride;
+            const uint8_t *b = frame + y * stride;
+            if (std::memcmp(a, b, stride) == 0)
+                continue;
+            top = std::min(top, y);
+            bottom = y;
+            int x = 0;
+            while (std::memcmp(a + x * 4, b + x * 4, 4) == 0)
+                x++;
+            int x_end = m_width - 1;
+            while (std::memcmp(a + x_end * 4, b + x_end * 4, 4) == 0)
+                x_end--;
+            left = std::min(left, x);
+            right = std::max(right, x_end);
+        }
+        if (bottom < 0)
+            return false;
+        out.x = left;
+        out.y = top;
+        out.w = right - left + 1;
+        out.h = bottom - top + 1;
+        return true;
+    }
+
+    int m_width;
+    int m_height;
+    int m_level;
+    std::vector<Frame> m_pending; // added but not uploaded yet
+    std::vector<int> m_gaps;      // of every frame
+    size_t m_sent = 0;            // frames on the terminal
+    bool m_gap_changed = false;
+    size_t m_encoded_size = 0;
+    KittyImage m_image;
+};
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "kgp.hpp"
+#include "mapped_file.hpp"
+#include "shm.hpp"
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <span>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include <zlib.h>
+
+// 64 bit FNV-1a over `bytes`, continuing from `hash`.
+inline auto content_hash(std::span<const uint8_t> bytes,
+                         uint64_t hash = 0xcbf29ce484222325ull) -> uint64_t {
+    for (uint8_t byte : bytes) {
+        hash ^= byte;
+        hash *= 0x100000001b3ull;
+    }
+    return hash ^ bytes.size();
+}
+
+inline auto is_png(std::span<const uint8_t> bytes) -> bool {
+    static constexpr uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    return bytes.size() >= sizeof(SIGNATURE) &&
+           std::memcmp(bytes.data(), SIGNATURE, sizeof(SIGNATURE)) == 0;
+}
+
+/*
+ * Static images (icons, logos, pictures) uploaded once per session and referenced by
+ * image id afterwards. Assets are keyed by a hash of their bytes (and, for raw pixels,
+ * their size), so the same content handed in twice, from memory or from a file, is
+ * transmitted once and just placed again.
+ *
+ * PNGs go out as they are (f=100): the terminal decodes them, so we skip decoding and
+ * recompressing. How the bytes travel depends on where the terminal runs:
+ *  - local (it accepted the shared memory probe): files on disk are sent by path (t=f),
+ *    in-memory data is written to a temporary file on tmpfs that the terminal reads and
+ *    deletes (t=t); only the path crosses the pty
+ *  - remote: the bytes are base64 encoded into the stream as usual
+ *
+ * Uploads are transmit only (a=t); place() shows an asset at the cursor. The PNG path of
+ * kgp_gif is the only caller so far: the GUI renders everything into its frame.
+ */
+class KittyAssets {
+public:
+    explicit KittyAssets(Transport transport)
+        : m_local(transport == Transport::SharedMemory) {
+        // tmpfs where available; the terminal only accepts t=t files from known temp
+        // directories whose name contains "tty-graphics-protocol"
+        const char *dir = std::getenv("TMPDIR");
+        if (access("/dev/shm", W_OK) == 0)
+            dir = "/dev/shm";
+        std::snprintf(m_temp_prefix, sizeof(m_temp_prefix), "%s/tty-graphics-protocol-%d",
+                      dir ? dir : "/tmp", static_cast<int>(getpid()));
+    }
+
+    KittyAssets(const KittyAssets &) = delete;
+    KittyAssets &operator=(const KittyAssets &) = delete;
+
+    // Image id of the PNG in `bytes`, uploading it the first time it is seen. 0 if the
+    // data is not a PNG.
+    auto png(std::span<const uint8_t> bytes, KittyWriter &writer = kitty_writer())
+        -> uint32_t {
+        if (!is_png(bytes)) {
+            std::cerr << "Not a PNG image\n";
+            return 0;
+        }
+        return cached(bytes, {}, [&](KittyImage &image) {
+            send(writer, image, "f=100", bytes);
+        });
+    }
+
+    // Same for a PNG file. A local terminal reads the file itself.
+    auto png_file(const char *path, KittyWriter &writer = kitty_writer()) -> uint32_t {
+        MappedFile file(path);
+        if (!file)
+            return 0;
+        if (!is_png(file.bytes())) {
+            std::cerr << "Not a PNG image: " << path << "\n";
+            return 0;
+        }
+        return cached(file.bytes(), {}, [&](KittyImage &image) {
+            char full_path[PATH_MAX];
+            if (m_local && realpath(path, full_path)) {
+                send_path(writer, image, "f=100,t=f", full_path);
+                return;
+            }
+            send(writer, image, "f=100", file.bytes());
+        });
+    }
+
+    // Same for raw top-down RGBA pixels, zlib compressed when they go through the pty.
+    auto rgba(const uint8_t *pixels, int width, int height,
+              KittyWriter &writer = kitty_writer()) -> uint32_t {
+        std::span<const uint8_t> bytes(pixels, static_cast<size_t>(width) * height * 4);
+        return cached(bytes, {32, width, height}, [&](KittyImage &image) {
+            char format[48];
+            std::snprintf(format, sizeof(format), "f=32,s=%d,v=%d", width, height);
+            if (m_local) {
+                send(writer, image, format, bytes);
+                return;
+            }
+            uLongf size = compressBound(bytes.size());
+            std::vector<uint8_t> compressed(size);
+            if (compress2(compressed.data(), &size, bytes.data(), bytes.size(),
+                          Z_DEFAULT_COMPRESSION) != Z_OK) {
+                send(writer, image, format, bytes);
+                return;
+            }
+            std::strcat(format, ",o=z");
+            send(writer, image, format, {compressed.data(), size});
+        });
+    }
+
+    // Shows asset `id` at the cursor, scaled to `cols` x `rows` cells if given. A second
+    // place() with the same placement id moves the existing placement.
+    auto place(uint32_t id, int cols = 0, int rows = 0,
+               uint32_t placement = KittyImage::PLACEMENT_ID,
+               KittyWriter &writer = kitty_writer()) -> void {
+        char cmd[96];
+        int n = std::snprintf(cmd, sizeof(cmd), "a=p,i=%u,p=%u,q=2,C=1", id, placement);
+        if (cols > 0 && rows > 0)
+            n += std::snprintf(cmd + n, sizeof(cmd) - n, ",c=%d,r=%d", cols, rows);
+        writer.send({cmd, static_cast<size_t>(n)});
+        writer.flush();
+    }
+
+    // Assets uploaded so far, and how many requests were answered from the cache.
+    [[nodiscard]] auto size() const -> size_t {
+        return m_images.size();
+    }
+
+    [[nodiscard]] auto hits() const -> size_t {
+        return m_hits;
+    }
+
+private:
+    // How the bytes of an asset are read: the f= format and, for raw pixels, the size.
+    // Part of the cache key, so equal pixels in another shape are a different asset.
+    struct Layout {
+        int32_t format = 100;
+        int32_t width = 0;
+        int32_t height = 0;
+    };
+
+    template <typename Upload>
+    auto cached(std::span<const uint8_t> bytes, Layout layout, Upload &&upload)
+        -> uint32_t {
+        const int32_t fields[] = {layout.format, layout.width, layout.height};
+        const auto *key = reinterpret_cast<const uint8_t *>(fields);
+        const uint64_t hash = content_hash(bytes, content_hash({key, sizeof(fields)}));
+        if (auto it = m_ids.find(hash); it != m_ids.end()) {
+            m_hits++;
+            return it->second;
+        }
+        KittyImage &image = m_images.emplace_back();
+        upload(image);
+        image.mark_uploaded();
+        m_ids.emplace(hash, image.id());
+        return image.id();
+    }
+
+    // Transmits `bytes`, through a temporary file for a local terminal.
+    auto send(KittyWriter &writer, const KittyImage &image, const char *format,
+              std::span<const uint8_t> bytes) -> void {
+        if (m_local) {
+            char path[PATH_MAX];
+            std::snprintf(path, sizeof(path), "%s-%u", m_temp_prefix, image.id());
+            if (write_file(path, bytes)) {
+                char keys[64];
+                std::snprintf(keys, sizeof(keys), "%s,t=t", format);
+                send_path(writer, image, keys, path);
+                return;
+            }
+        }
+        char cmd[96];
+        int n = std::snprintf(cmd, sizeof(cmd), "a=t,i=%u,q=2,%s", image.id(), format);
+        writer.send({cmd, static_cast<size_t>(n)}, bytes.data(), bytes.size());
+        writer.flush();
+    }
+
+    // The payload of t=f and t=t is the path itself.
+    static auto send_path(KittyWriter &writer, const KittyImage &image, const char *keys,
+                          const char *path) -> void {
+        char cmd[96];
+        int n = std::snprintf(cmd, sizeof(cmd), "a=t,i=%u,q=2,%s", image.id(), keys);
+        writer.send({cmd, static_cast<size_t>(n)},
+                    reinterpret_cast<const uint8_t *>(path), std::strlen(path));
+        writer.flush();
+    }
+
+    static auto write_file(const char *path, std::span<const uint8_t> bytes) -> bool {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            std::cerr << "Failed to create " << path << ": " << std::strerror(errno)
+                      << "\n";
+            return false;
+        }
+        size_t written = 0;
+        while (written < bytes.size()) {
+            ssize_t n = write(fd, bytes.data() + written, bytes.size() - written);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                std::cerr << "Failed to write " << path << ": " << std::strerror(errno)
+                          << "\n";
+                close(fd);
+                unlink(path);
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+        close(fd);
+        return true;
+    }
+
+    bool m_local;
+    char m_temp_prefix[128];
+    std::unordered_map<uint64_t, uint32_t> m_ids; // content hash -> image id
+    std::deque<KittyImage> m_images;              // deleted from the terminal on exit
+    size_t m_hits = 0;
+};
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KGP_BASE64_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define KGP_BASE64_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Base64 encoding (RFC 4648, with padding) for the graphics protocol payloads.
+ * The SIMD kernels follow the approach from Wojciech Muła and Daniel Lemire,
+ * "Faster Base64 Encoding and Decoding using AVX2 Instructions" (also used by simdutf):
+ * reshuffle 3 input bytes into 4 lanes, extract the 6-bit indices with multiplies (or
+ * vpmultishiftqb on AVX-512VBMI) and translate indices to ASCII with a table lookup.
+ *
+ * Every kernel only encodes whole 3-byte groups and hands the tail to the scalar
+ * encoder, so all paths produce byte-identical output.
+ *
+ * Decoding is only needed by the receiving side in tests (fake_terminal.hpp), so it has
+ * the scalar path alone.
+ */
+
+inline constexpr uint8_t base64enc_tab[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+enum class Base64Path { Scalar, SSSE3, AVX2, AVX512VBMI, NEON };
+
+using base64_encode_fn = int (*)(size_t in_len, const uint8_t *in, size_t out_len,
+                                 char *out);
+
+inline auto base64_encoded_size(size_t in_len) -> size_t {
+    return ((in_len + 2) / 3) * 4;
+}
+
+inline int base64_encode_scalar(size_t in_len, const uint8_t *in, size_t out_len,
+                                char *out) {
+    uint ii, io;
+    uint_least32_t v;
+    uint rem;
+
+    for (io = 0, ii = 0, v = 0, rem = 0; ii < in_len; ii++) {
+        uint8_t ch;
+        ch = in[ii];
+        v = (v << 8) | ch;
+        rem += 8;
+        while (rem >= 6) {
+            rem -= 6;
+            if (io >= out_len)
+                return -1; /* truncation is failure */
+            out[io++] = static_cast<char>(base64enc_tab[(v >> rem) & 63]);
+        }
+    }
+    if (rem) {
+        v <<= (6 - rem);
+        if (io >= out_len)
+            return -1; /* truncation is failure */
+        out[io++] = static_cast<char>(base64enc_tab[v & 63]);
+    }
+    while (io & 3) {
+        if (io >= out_len)
+            return -1; /* truncation is failure */
+        out[io++] = '=';
+    }
+    if (io >= out_len)
+        return -1; /* no room for null terminator */
+    out[io] = 0;
+    return io;
+}
+
+// Encodes the remaining bytes after a SIMD kernel consumed `done` input bytes (always a
+// multiple of 3) and returns the total length, or -1 like the scalar encoder.
+inline int base64_finish(size_t in_len, const uint8_t *in, size_t out_len, char *out,
+                         size_t done) {
+    size_t written = (done / 3) * 4;
+    int ret = base64_encode_scalar(in_len - done, in + done, out_len - written,
+                                   out + written);
+    if (ret < 0)
+        return -1;
+    return static_cast<int>(written) + ret;
+}
+
+#ifdef KGP_BASE64_X86
+
+// 16 bytes with 12 input bytes in the low lanes -> 16 6-bit indices, one per byte
+__attribute__((target("ssse3"))) inline auto base64_indices_ssse3(__m128i in)
+    -> __m128i {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2,
+                                           0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3"))) inline auto base64_lookup_ssse3(__m128i indices)
+    -> __m128i {
+    __m128i result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i shift_lut = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    result = _mm_shuffle_epi8(shift_lut, result);
+    return _mm_add_epi8(result, indices);
+}
+
+__attribute__((target("ssse3"))) inline int
+base64_encode_ssse3(size_t in_len, const uint8_t *in, size_t out_len, char *out) {
+    if (out_len < base64_encoded_size(in_len) + 1)
+        return -1;
+
+    size_t done = 0;
+    // each step reads 16 bytes but only consumes 12
+    for (; done + 16 <= in_len; done += 12) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        const __m128i ascii = base64_lookup_ssse3(base64_indices_ssse3(v));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (done / 3) * 4), ascii);
+    }
+    return base64_finish(in_len, in, out_len, out, done);
+}
+
+__attribute__((target("avx2"))) inline int
+base64_encode_avx2(size_t in_len, const uint8_t *in, size_t out_len, char *out) {
+    if (out_len < base64_encoded_size(in_len) + 1)
+        return -1;
+
+    const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9,
+                                             11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7,
+                                             10, 9, 11, 10);
+    const __m256i shift_lut = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0, 'a' - 26, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    size_t done = 0;
+    // each step reads 28 bytes (two overlapping 16 byte loads) but only consumes 24
+    for (; done + 28 <= in_len; done += 24) {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done));
+        const __m128i hi =
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + done + 12));
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+        v = _mm256_shuffle_epi8(v, shuffle);
+        const __m256i t0 = _mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        result = _mm256_or_si256(result, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        result = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, result), indices);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + (done / 3) * 4), result);
+    }
+    return base64_finish(in_len, in, out_len, out, done);
+}
+
+// GCC 12 warns about the `_mm512_undefined_epi32()` passthrough inside its own
+// intrinsic headers (GCC bug 105593)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi"))) inline int
+base64_encode_avx512vbmi(size_t in_len, const uint8_t *in, size_t out_len, char *out) {
+    if (out_len < base64_encoded_size(in_len) + 1)
+        return -1;
+
+    // spread 48 input bytes into 16 groups of 4 bytes: [b1 b0 b2 b1] per 3 byte group
+    const __m512i shuffle = _mm512_setr_epi32(
+        0x01020001, 0x04050304, 0x07080607, 0x0a0b090a, 0x0d0e0c0d, 0x10110f10,
+        0x13141213, 0x16171516, 0x191a1819, 0x1c1d1b1c, 0x1f201e1f, 0x22232122,
+        0x25262425, 0x28292728, 0x2b2c2a2b, 0x2e2f2d2e);
+    // bit offsets of the four 6-bit fields inside each 32-bit group
+    const __m512i shifts = _mm512_set1_epi64(0x3036242a1016040all);
+    const __m512i lookup = _mm512_loadu_si512(base64enc_tab);
+
+    size_t done = 0;
+    for (; done + 48 <= in_len; done += 48) {
+        // masked load, so we never read past the 48 bytes we consume
+        const __m512i v = _mm512_maskz_loadu_epi8(0x0000ffffffffffffull, in + done);
+        const __m512i grouped = _mm512_permutexvar_epi8(shuffle, v);
+        const __m512i indices = _mm512_multishift_epi64_epi8(shifts, grouped);
+        const __m512i result = _mm512_permutexvar_epi8(indices, lookup);
+        _mm512_storeu_si512(out + (done / 3) * 4, result);
+    }
+    return base64_finish(in_len, in, out_len, out, done);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // KGP_BASE64_X86
+
+#ifdef KGP_BASE64_NEON
+
+inline int base64_encode_neon(size_t in_len, const uint8_t *in, size_t out_len,
+                              char *out) {
+    if (out_len < base64_encoded_size(in_len) + 1)
+        return -1;
+
+    const uint8x16x4_t lookup = vld1q_u8_x4(base64enc_tab);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+
+    size_t done = 0;
+    for (; done + 48 <= in_len; done += 48) {
+        // de-interleave 16 groups of 3 bytes
+        const uint8x16x3_t v = vld3q_u8(in + done);
+        uint8x16x4_t idx;
+        idx.val[0] = vshrq_n_u8(v.val[0], 2);
+        idx.val[1] =
+            vandq_u8(vorrq_u8(vshlq_n_u8(v.val[0], 4), vshrq_n_u8(v.val[1], 4)), mask);
+        idx.val[2] =
+            vandq_u8(vorrq_u8(vshlq_n_u8(v.val[1], 2), vshrq_n_u8(v.val[2], 6)), mask);
+        idx.val[3] = vandq_u8(v.val[2], mask);
+
+        uint8x16x4_t ascii;
+        ascii.val[0] = vqtbl4q_u8(lookup, idx.val[0]);
+        ascii.val[1] = vqtbl4q_u8(lookup, idx.val[1]);
+        ascii.val[2] = vqtbl4q_u8(lookup, idx.val[2]);
+        ascii.val[3] = vqtbl4q_u8(lookup, idx.val[3]);
+        vst4q_u8(reinterpret_cast<uint8_t *>(out + (done / 3) * 4), ascii);
+    }
+    return base64_finish(in_len, in, out_len, out, done);
+}
+
+#endif // KGP_BASE64_NEON
+
+inline auto base64_path_name(Base64Path path) -> const char * {
+    switch (path) {
+    case Base64Path::Scalar: return "scalar";
+    case Base64Path::SSSE3: return "ssse3";
+    case Base64Path::AVX2: return "avx2";
+    case Base64Path::AVX512VBMI: return "avx512vbmi";
+    case Base64Path::NEON: return "neon";
+    }
+    return "unknown";
+}
+
+// Whether `path` was compiled in and can run on this CPU.
+inline auto base64_path_supported(Base64Path path) -> bool {
+    switch (path) {
+    case Base64Path::Scalar: return true;
+#ifdef KGP_BASE64_X86
+    case Base64Path::SSSE3: return __builtin_cpu_supports("ssse3");
+    case Base64Path::AVX2: return __builtin_cpu_supports("avx2");
+    case Base64Path::AVX512VBMI:
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("avx512vbmi");
+#endif
+#ifdef KGP_BASE64_NEON
+    case Base64Path::NEON: return true;
+#endif
+    default: return false;
+    }
+}
+
+inline auto base64_path_fn(Base64Path path) -> base64_encode_fn {
+    switch (path) {
+#ifdef KGP_BASE64_X86
+    case Base64Path::SSSE3: return base64_encode_ssse3;
+    case Base64Path::AVX2: return base64_encode_avx2;
+    case Base64Path::AVX512VBMI: return base64_encode_avx512vbmi;
+#endif
+#ifdef KGP_BASE64_NEON
+    case Base64Path::NEON: return base64_encode_neon;
+#endif
+    default: return base64_encode_scalar;
+    }
+}
+
+// Fastest path supported by the running CPU. Setting KGP_BASE64=scalar|ssse3|avx2|...
+// in the environment overrides the choice (handy when comparing paths).
+inline auto base64_best_path() -> Base64Path {
+    constexpr Base64Path preference[] = {Base64Path::AVX512VBMI, Base64Path::AVX2,
+                                         Base64Path::NEON, Base64Path::SSSE3};
+
+    if (const char *forced = std::getenv("KGP_BASE64")) {
+        for (auto path : {Base64Path::Scalar, Base64Path::SSSE3, Base64Path::AVX2,
+                          Base64Path::AVX512VBMI, Base64Path::NEON}) {
+            if (std::string_view(forced) == base64_path_name(path) &&
+                base64_path_supported(path))
+                return path;
+        }
+    }
+    for (auto path : preference) {
+        if (base64_path_supported(path))
+            return path;
+    }
+    return Base64Path::Scalar;
+}
+
+// Resolved once on first use, then a plain indirect call.
+inline auto base64_active_path() -> Base64Path {
+    static const Base64Path path = base64_best_path();
+    return path;
+}
+
+inline int base64_encode(size_t in_len, const uint8_t *in, size_t out_len, char *out) {
+    static const base64_encode_fn impl = base64_path_fn(base64_active_path());
+    return impl(in_len, in, out_len, out);
+}
+
+// Decodes RFC 4648 base64; the padding of the last group is optional. Returns the number
+// of bytes written, or -1 on a character outside the alphabet or if `out_len` is short.
+inline int base64_decode(size_t in_len, const char *in, size_t out_len, uint8_t *out) {
+    static constexpr auto table = [] {
+        std::array<int8_t, 256> t{};
+        for (auto &v : t)
+            v = -1;
+        for (int i = 0; i < 64; i++)
+            t[base64enc_tab[i]] = static_cast<int8_t>(i);
+        return t;
+    }();
+
+    while (in_len > 0 && in[in_len - 1] == '=')
+        in_len--;
+    const size_t decoded = in_len / 4 * 3 + (in_len % 4 ? in_len % 4 - 1 : 0);
+    if (in_len % 4 == 1 || decoded > out_len)
+        return -1;
+
+    size_t io = 0;
+    uint32_t v = 0;
+    int bits = 0;
+    for (size_t ii = 0; ii < in_len; ii++) {
+        const int8_t sextet = table[static_cast<uint8_t>(in[ii])];
+        if (sextet < 0)
+            return -1;
+        v = (v << 6) | static_cast<uint32_t>(sextet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out[io++] = static_cast<uint8_t>(v >> bits);
+        }
+    }
+    return static_cast<int>(io);
+}
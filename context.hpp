@@ -0,0 +1,323 @@
+#pragma once
+
+#include "imgui.h"
+#include "imgui_impl_glfw.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <string_view>
+#include <unistd.h>
+#ifdef KGP_HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+/*
+ * The GL context frames are rendered with. Nothing is ever shown on screen: the GUI
+ * draws into its own frame buffer object and reads that back, so all we need from the
+ * platform is a current context and a way to sleep until there is work.
+ *  - Glfw: a hidden GLFW window. Needs an X11 or Wayland display, and its startup pays
+ *    for connecting to it.
+ *  - Egl: a surfaceless EGL context (EGL_MESA_platform_surfaceless), no display server
+ *    at all. Mesa picks the GPU through its render node, or llvmpipe without one, so it
+ *    runs over SSH and in containers. Only built with KGP_HAVE_EGL.
+ *  - None: no GL at all, for the CPU rasterizer (raster.hpp, KGP_RENDERER=cpu). Only
+ *    the event loop is left.
+ *
+ * KGP_GL=glfw|egl picks one. Otherwise EGL is used when no display server is reachable
+ * (neither DISPLAY nor WAYLAND_DISPLAY is set), and GLFW is the fallback either way.
+ *
+ * Without GLFW's event loop, wait_events() sleeps on a pipe that wake() writes to; with
+ * it, wake() posts an empty GLFW event. Either way the tty reader thread wakes the
+ * render loop with wake().
+ */
+enum class GLBackend { Glfw, Egl, None };
+
+[[nodiscard]] inline auto gl_backend_name(GLBackend backend) -> const char * {
+    switch (backend) {
+    case GLBackend::Glfw: return "glfw";
+    case GLBackend::Egl: return "egl";
+    case GLBackend::None: return "none";
+    }
+    return "?";
+}
+
+inline auto gl_backend_from_env() -> GLBackend {
+    if (const char *forced = std::getenv("KGP_GL")) {
+        if (std::string_view(forced) == "egl")
+            return GLBackend::Egl;
+        if (std::string_view(forced) != "glfw")
+            std::cerr << "Unknown KGP_GL " << forced << ", using glfw\n";
+        return GLBackend::Glfw;
+    }
+#ifdef KGP_HAVE_EGL
+    if (!std::getenv("DISPLAY") && !std::getenv("WAYLAND_DISPLAY"))
+        return GLBackend::Egl;
+#endif
+    return GLBackend::Glfw;
+}
+
+class OffscreenContext {
+public:
+    // Creates a GL 3.2 core context and makes it current, or with GLBackend::None only
+    // the wake pipe. `width` x `height` only sizes the hidden GLFW window. Falls back to
+    // GLFW if EGL is unavailable; check with operator bool.
+    OffscreenContext(GLBackend backend, int width, int height) {
+        if (backend == GLBackend::None) {
+            m_backend = GLBackend::None;
+            m_ready = open_wake_pipe();
+            return;
+        }
+        if (backend == GLBackend::Egl) {
+#ifdef KGP_HAVE_EGL
+            if (create_egl())
+                return;
+            destroy_egl();
+            std::cerr << "EGL context unavailable, falling back to GLFW\n";
+#else
+            std::cerr << "Built without EGL, using GLFW\n";
+#endif
+        }
+        create_glfw(width, height);
+    }
+
+    OffscreenContext(const OffscreenContext &) = delete;
+    OffscreenContext &operator=(const OffscreenContext &) = delete;
+
+    ~OffscreenContext() {
+        if (m_backend == GLBackend::Glfw) {
+            s_glfw.store(false, std::memory_order_relaxed);
+            if (m_window)
+                glfwDestroyWindow(m_window);
+            glfwTerminate();
+            return;
+        }
+#ifdef KGP_HAVE_EGL
+        destroy_egl();
+#endif
+        close_wake_pipe();
+    }
+
+    explicit operator bool() const {
+        return m_ready;
+    }
+
+    [[nodiscard]] auto backend() const -> GLBackend {
+        return m_backend;
+    }
+
+    // Hooks up the ImGui platform side. With GLFW its backend does the bookkeeping;
+    // without a window only the frame timing is left, done in new_frame().
+    auto init_imgui() -> void {
+        if (m_backend == GLBackend::Glfw) {
+            ImGui_ImplGlfw_InitForOpenGL(m_window, true);
+            return;
+        }
+        ImGui::GetIO().BackendPlatformName =
+            m_backend == GLBackend::Egl ? "kgp_egl" : "kgp_headless";
+        m_last_frame = std::chrono::steady_clock::now();
+    }
+
+    auto new_frame() -> void {
+        if (m_backend == GLBackend::Glfw) {
+            ImGui_ImplGlfw_NewFrame();
+            return;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        const std::chrono::duration<float> delta = now - m_last_frame;
+        m_last_frame = now;
+        ImGui::GetIO().DeltaTime = std::max(delta.count(), 1e-4f);
+    }
+
+    auto shutdown_imgui() -> void {
+        if (m_backend == GLBackend::Glfw)
+            ImGui_ImplGlfw_Shutdown();
+        else
+            ImGui::GetIO().BackendPlatformName = nullptr;
+    }
+
+    [[nodiscard]] auto should_close() const -> bool {
+        return m_backend == GLBackend::Glfw && glfwWindowShouldClose(m_window);
+    }
+
+    auto poll_events() -> void {
+        if (m_backend == GLBackend::Glfw)
+            glfwPollEvents();
+        else
+            drain_wake_pipe();
+    }
+
+    // Sleeps until wake() or, with a timeout >= 0, until `timeout_s` seconds passed.
+    auto wait_events(double timeout_s = -1) -> void {
+        if (m_backend == GLBackend::Glfw) {
+            if (timeout_s < 0)
+                glfwWaitEvents();
+            else
+                glfwWaitEventsTimeout(timeout_s);
+            return;
+        }
+        pollfd pfd = {m_wake_pipe[0], POLLIN, 0};
+        const int timeout_ms =
+            timeout_s < 0 ? -1 : static_cast<int>(std::ceil(timeout_s * 1e3));
+        if (poll(&pfd, 1, timeout_ms) > 0)
+            drain_wake_pipe();
+    }
+
+    // Wakes a wait_events() in progress, or makes the next one return at once. Safe
+    // from any thread.
+    static auto wake() -> void {
+        if (s_glfw.load(std::memory_order_relaxed)) {
+            glfwPostEmptyEvent();
+            return;
+        }
+        const int fd = s_wake_fd.load(std::memory_order_relaxed);
+        if (fd >= 0)
+            (void)!write(fd, "w", 1);
+    }
+
+private:
+    static auto glfw_error_callback(int error, const char *description) -> void {
+        std::fprintf(stderr, "GLFW Error %d: %s\n", error, description);
+    }
+
+    auto create_glfw(int width, int height) -> void {
+        m_backend = GLBackend::Glfw;
+        glfwSetErrorCallback(glfw_error_callback);
+        if (!glfwInit())
+            return;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);           // Required on Mac
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        m_window = glfwCreateWindow(width, height, "headless gui", nullptr, nullptr);
+        if (!m_window)
+            return;
+        glfwMakeContextCurrent(m_window);
+        glfwSwapInterval(1); // Enable vsync
+        s_glfw.store(true, std::memory_order_relaxed);
+        m_ready = true;
+    }
+
+    auto open_wake_pipe() -> bool {
+        if (pipe2(m_wake_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+            std::cerr << "Failed to create wake pipe: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        s_wake_fd.store(m_wake_pipe[1], std::memory_order_relaxed);
+        return true;
+    }
+
+    auto close_wake_pipe() -> void {
+        s_wake_fd.store(-1, std::memory_order_relaxed);
+        for (int &fd : m_wake_pipe) {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+    }
+
+    auto drain_wake_pipe() -> void {
+        char buf[64];
+        while (read(m_wake_pipe[0], buf, sizeof(buf)) > 0)
+            ;
+    }
+
+#ifdef KGP_HAVE_EGL
+    auto create_egl() -> bool {
+        m_backend = GLBackend::Egl;
+        auto get_platform_display = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (get_platform_display) {
+            m_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                             EGL_DEFAULT_DISPLAY, nullptr);
+        }
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, nullptr, nullptr)) {
+            std::cerr << "No surfaceless EGL display\n";
+            m_display = EGL_NO_DISPLAY;
+            return false;
+        }
+        const char *extensions = eglQueryString(m_display, EGL_EXTENSIONS);
+        if (!extensions || !std::strstr(extensions, "EGL_KHR_surfaceless_context")) {
+            std::cerr << "EGL lacks EGL_KHR_surfaceless_context\n";
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            std::cerr << "EGL cannot bind desktop OpenGL\n";
+            return false;
+        }
+
+        // the surfaceless platform only has pbuffer configs; none is ever created
+        const EGLint config_attribs[] = {EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+                                         EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                         EGL_RED_SIZE,        8,
+                                         EGL_GREEN_SIZE,      8,
+                                         EGL_BLUE_SIZE,       8,
+                                         EGL_NONE};
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(m_display, config_attribs, &config, 1, &configs) ||
+            configs == 0) {
+            std::cerr << "No EGL config for desktop OpenGL\n";
+            return false;
+        }
+        const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                          3,
+                                          EGL_CONTEXT_MINOR_VERSION,
+                                          2,
+                                          EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                          EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                          EGL_NONE};
+        m_context = eglCreateContext(m_display, config, EGL_NO_CONTEXT, context_attribs);
+        if (m_context == EGL_NO_CONTEXT) {
+            std::cerr << "eglCreateContext failed: 0x" << std::hex << eglGetError()
+                      << std::dec << "\n";
+            return false;
+        }
+        if (!eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context)) {
+            std::cerr << "eglMakeCurrent failed: 0x" << std::hex << eglGetError()
+                      << std::dec << "\n";
+            return false;
+        }
+
+        if (!open_wake_pipe())
+            return false;
+        m_ready = true;
+        return true;
+    }
+
+    auto destroy_egl() -> void {
+        close_wake_pipe();
+        if (m_display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (m_context != EGL_NO_CONTEXT)
+            eglDestroyContext(m_display, m_context);
+        eglTerminate(m_display);
+        m_context = EGL_NO_CONTEXT;
+        m_display = EGL_NO_DISPLAY;
+        m_ready = false;
+    }
+
+    EGLDisplay m_display = EGL_NO_DISPLAY;
+    EGLContext m_context = EGL_NO_CONTEXT;
+#endif
+
+    static inline std::atomic<bool> s_glfw = false;
+    static inline std::atomic<int> s_wake_fd = -1;
+
+    GLBackend m_backend = GLBackend::Glfw;
+    bool m_ready = false;
+    GLFWwindow *m_window = nullptr;
+    int m_wake_pipe[2] = {-1, -1};
+    std::chrono::steady_clock::time_point m_last_frame;
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/*
+ * pigz-style parallel zlib compression. The frame is cut into BLOCK_SIZE blocks that are
+ * deflated independently on a pool of worker threads, each block primed with the last
+ * 32 KiB of the one before it as a preset dictionary so the ratio stays close to a
+ * single stream. Every block but the last ends with a sync flush (byte aligned, no final
+ * bit), so the raw deflate outputs can simply be concatenated between a zlib header and
+ * the combined Adler-32 of the whole input: one valid RFC 1950 stream for `o=z`.
+ *
+ * The worker threads and their z_stream state live as long as the compressor, so a frame
+ * only costs deflateReset() per block.
+ */
+class ParallelDeflate {
+public:
+    static constexpr size_t BLOCK_SIZE = 128 * 1024;
+    static constexpr size_t DICT_SIZE = 32 * 1024;
+
+    explicit ParallelDeflate(int level = Z_DEFAULT_COMPRESSION, unsigned threads = 0)
+        : m_level(level) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        // the calling thread works too
+        m_streams.resize(threads);
+        for (auto &stream : m_streams)
+            init_stream(stream);
+        for (unsigned i = 1; i < threads; i++)
+            m_workers.emplace_back([this, i] { worker(i); });
+    }
+
+    ParallelDeflate(const ParallelDeflate &) = delete;
+    ParallelDeflate &operator=(const ParallelDeflate &) = delete;
+
+    ~ParallelDeflate() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (auto &worker : m_workers)
+            worker.join();
+        for (auto &stream : m_streams)
+            deflateEnd(&stream);
+    }
+
+    // Takes effect from the next compress() call.
+    auto set_level(int level) -> void {
+        if (level == m_level)
+            return;
+        m_level = level;
+        for (auto &stream : m_streams) {
+            deflateReset(&stream); // deflateParams may flush, keep the stream idle
+            deflateParams(&stream, m_level, Z_DEFAULT_STRATEGY);
+        }
+    }
+
+    [[nodiscard]] auto level() const -> int {
+        return m_level;
+    }
+
+    // Upper bound of compress() output for `size` bytes of input, at any level.
+    static auto bound(size_t size) -> size_t {
+        const size_t blocks = std::max<size_t>(1, (size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        return 2 + 4 + blocks * block_bound();
+    }
+
+    // Sizes the internal buffers for inputs up to `max_size` bytes, so compress() never
+    // allocates afterwards.
+    auto reserve(size_t max_size) -> void {
+        const size_t blocks =
+            std::max<size_t>(1, (max_size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (m_blocks.size() < blocks)
+            m_blocks.resize(blocks);
+        for (auto &block : m_blocks) {
+            if (block.out.size() < block_bound())
+                block.out.resize(block_bound());
+        }
+        if (m_output.size() < bound(max_size))
+            m_output.resize(bound(max_size));
+    }
+
+    // Compresses `size` bytes into a zlib stream. The result points into an internal
+    // buffer that is reused by the next call; empty on failure.
+    auto compress(const uint8_t *data, size_t size) -> std::span<const uint8_t> {
+        m_input = data;
+        m_input_size = size;
+        m_block_count = std::max<size_t>(1, (size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        if (m_blocks.size() < m_block_count)
+            m_blocks.resize(m_block_count);
+        m_failed = false;
+
+        {
+            std::lock_guard lock(m_mutex);
+            m_next_block = 0;
+            m_done_workers = 0;
+            m_generation++;
+        }
+        m_start.notify_all();
+        run_blocks(m_streams[0]);
+        {
+            std::unique_lock lock(m_mutex);
+            m_finished.wait(lock, [this] { return m_done_workers == m_workers.size(); });
+        }
+        if (m_failed)
+            return {};
+
+        return join();
+    }
+
+private:
+    struct Block {
+        std::vector<uint8_t> out;
+        size_t out_size = 0;
+        uLong adler = 1;
+    };
+
+    // Worst case for one block: stored blocks (compressBound) plus the sync flush marker.
+    // Blocks never exceed BLOCK_SIZE, so every block buffer gets this one size.
+    static auto block_bound() -> size_t {
+        return compressBound(BLOCK_SIZE) + 16;
+    }
+
+    auto init_stream(z_stream &stream) -> void {
+        stream = {};
+        // negative window bits: raw deflate, we write the zlib wrapper ourselves
+        if (deflateInit2(&stream, m_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) !=
+            Z_OK) {
+            std::cerr << "deflateInit2 failed\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    auto worker(unsigned index) -> void {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop)
+                    return;
+                seen = m_generation;
+            }
+            run_blocks(m_streams[index]);
+            {
+                std::lock_guard lock(m_mutex);
+                m_done_workers++;
+            }
+            m_finished.notify_one();
+        }
+    }
+
+    auto run_blocks(z_stream &stream) -> void {
+        for (;;) {
+            size_t index = m_next_block.fetch_add(1);
+            if (index >= m_block_count)
+                return;
+            if (!compress_block(stream, index))
+                m_failed = true;
+        }
+    }
+
+    auto compress_block(z_stream &stream, size_t index) -> bool {
+        const size_t begin = index * BLOCK_SIZE;
+        const size_t length = std::min(BLOCK_SIZE, m_input_size - begin);
+        const bool last = index + 1 == m_block_count;
+        Block &block = m_blocks[index];
+
+        deflateReset(&stream);
+        if (begin > 0) {
+            const size_t dict = std::min(DICT_SIZE, begin);
+            deflateSetDictionary(&stream, m_input + begin - dict,
+                                 static_cast<uInt>(dict));
+        }
+
+        if (block.out.size() < block_bound())
+            block.out.resize(block_bound());
+
+        stream.next_in = const_cast<Bytef *>(m_input + begin);
+        stream.avail_in = static_cast<uInt>(length);
+        stream.next_out = block.out.data();
+        stream.avail_out = static_cast<uInt>(block.out.size());
+        int ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (ret != (last ? Z_STREAM_END : Z_OK) || stream.avail_in != 0)
+            return false;
+
+        block.out_size = block.out.size() - stream.avail_out;
+        block.adler = adler32(1, m_input + begin, static_cast<uInt>(length));
+        return true;
+    }
+
+    auto join() -> std::span<const uint8_t> {
+        size_t total = 2 + 4;
+        for (size_t i = 0; i < m_block_count; i++)
+            total += m_blocks[i].out_size;
+        if (m_output.size() < total)
+            m_output.resize(total);
+
+        // zlib header: deflate with a 32K window, FLEVEL matching the level, FCHECK
+        uint8_t *out = m_output.data();
+        const int level = m_level == Z_DEFAULT_COMPRESSION ? 6 : m_level;
+        const int flevel = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        unsigned header = (0x78u << 8) | (static_cast<unsigned>(flevel) << 6);
+        header += 31 - header % 31;
+        *out++ = static_cast<uint8_t>(header >> 8);
+        *out++ = static_cast<uint8_t>(header);
+
+        uLong adler = 1;
+        for (size_t i = 0; i < m_block_count; i++) {
+            const Block &block = m_blocks[i];
+            std::memcpy(out, block.out.data(), block.out_size);
+            out += block.out_size;
+            const size_t length = std::min(BLOCK_SIZE, m_input_size - i * BLOCK_SIZE);
+            adler = adler32_combine(adler, block.adler, static_cast<z_off_t>(length));
+        }
+        *out++ = static_cast<uint8_t>(adler >> 24);
+        *out++ = static_cast<uint8_t>(adler >> 16);
+        *out++ = static_cast<uint8_t>(adler >> 8);
+        *out++ = static_cast<uint8_t>(adler);
+        return {m_output.data(), total};
+    }
+
+    int m_level;
+    std::vector<z_stream> m_streams; // one per thread, index 0 is the caller's
+    std::vector<std::thread> m_workers;
+    std::vector<Block> m_blocks;
+    std::vector<uint8_t> m_output;
+
+    const uint8_t *m_input = nullptr;
+    size_t m_input_size = 0;
+    size_t m_block_count = 0;
+    std::atomic<size_t> m_next_block = 0;
+    std::atomic<bool> m_failed = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_finished;
+    uint64_t m_generation = 0;
+    size_t m_done_workers = 0;
+    bool m_stop = false;
+};
+
+// KGP_ZLIB_LEVEL=0..9 picks the speed/ratio trade-off, zlib's default (6) otherwise.
+inline auto zlib_level_from_env() -> int {
+    const char *env = std::getenv("KGP_ZLIB_LEVEL");
+    if (!env || *env < '0' || *env > '9' || env[1] != 0)
+        return Z_DEFAULT_COMPRESSION;
+    return *env - '0';
+}
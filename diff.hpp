@@ -0,0 +1,244 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+
+/*
+ * Tile based frame differ. Each frame is compared against the previous one in TILE x
+ * TILE blocks; changed tiles are merged into rectangles (runs along a tile row, then
+ * stacked runs with the same horizontal extent) which can be sent as `a=f` edits of a
+ * persistent image instead of re-sending the whole frame.
+ *
+ * With `deltas` on, update() also keeps what the changed tiles held before, so
+ * extract_delta() can tell which pixels of a rectangle actually changed.
+ */
+class FrameDiff {
+public:
+    static constexpr int TILE = 64;
+    // past this many rectangles a single bounding box is cheaper to send
+    static constexpr size_t MAX_RECTS = 32;
+
+    struct Rect {
+        int x, y, w, h;
+    };
+
+    FrameDiff(int width, int height, int channels = 4, bool deltas = false)
+        : m_width(width), m_height(height), m_channels(channels),
+          m_previous(static_cast<size_t>(width) * height * channels),
+          m_changed(static_cast<size_t>(tiles_x()) * tiles_y()) {
+        m_rects.reserve(tiles_x() * tiles_y());
+        m_open.reserve(tiles_x());
+        if (deltas) {
+            m_before.resize(m_previous.size());
+            m_packed.reserve(static_cast<size_t>(width) * height * 4);
+        } else {
+            m_packed.reserve(m_previous.size());
+        }
+    }
+
+    // Compares `frame` (top-down rows) with the previous one, remembers it and returns
+    // the changed rectangles. The first call after construction or reset() returns the
+    // whole frame; an empty result means nothing changed.
+    auto update(const uint8_t *frame) -> std::span<const Rect> {
+        m_rects.clear();
+        std::fill(m_changed.begin(), m_changed.end(), 0);
+        if (!m_valid) {
+            std::memcpy(m_previous.data(), frame, m_previous.size());
+            m_valid = true;
+            m_rects.push_back({0, 0, m_width, m_height});
+            return m_rects;
+        }
+
+        const size_t stride = static_cast<size_t>(m_width) * m_channels;
+        m_open.clear();
+        for (int ty = 0; ty < tiles_y(); ty++) {
+            const int y = ty * TILE;
+            const int h = std::min(TILE, m_height - y);
+            size_t open_before = m_open.size();
+
+            for (int tx = 0; tx < tiles_x();) {
+                if (!tile_changed(frame, tx, y, h, stride)) {
+                    tx++;
+                    continue;
+                }
+                // extend the run along this tile row
+                int run_start = tx++;
+                while (tx < tiles_x() && tile_changed(frame, tx, y, h, stride))
+                    tx++;
+
+                const int x = run_start * TILE;
+                const int w = std::min(tx * TILE, m_width) - x;
+                std::fill_n(m_changed.begin() + ty * tiles_x() + run_start,
+                            tx - run_start, 1);
+                copy_back(frame, x, y, w, h, stride);
+                add_run(x, y, w, h, open_before);
+            }
+            close_runs(y + h);
+        }
+        close_runs(-1);
+
+        if (m_rects.size() > MAX_RECTS)
+            collapse();
+        return m_rects;
+    }
+
+    // Packs the pixels of `rect` from `frame` into contiguous rows, as `a=f` expects.
+    auto extract(const uint8_t *frame, const Rect &rect) -> std::span<const uint8_t> {
+        const size_t stride = static_cast<size_t>(m_width) * m_channels;
+        const size_t row = static_cast<size_t>(rect.w) * m_channels;
+        m_packed.resize(row * rect.h);
+        for (int y = 0; y < rect.h; y++) {
+            std::memcpy(m_packed.data() + y * row,
+                        frame + (rect.y + y) * stride + rect.x * m_channels, row);
+        }
+        return m_packed;
+    }
+
+    // Packs `rect` of `frame` as RGBA rows of what changed since the frame before the
+    // last update(): transparent zeros where a pixel stayed the same, the new pixel made
+    // opaque where it did not. Blended onto the old frame, the result is `frame`. Needs
+    // `deltas` on and a rectangle update() returned.
+    auto extract_delta(const uint8_t *frame, const Rect &rect)
+        -> std::span<const uint8_t> {
+        assert(!m_before.empty());
+        const size_t stride = static_cast<size_t>(m_width) * m_channels;
+        const size_t row = static_cast<size_t>(rect.w) * 4;
+        m_packed.resize(row * rect.h);
+        uint8_t *out = m_packed.data();
+        for (int y = rect.y; y < rect.y + rect.h; y++) {
+            const uint8_t *changed = m_changed.data() + y / TILE * tiles_x();
+            for (int x = rect.x; x < rect.x + rect.w;) {
+                const int end = std::min((x / TILE + 1) * TILE, rect.x + rect.w);
+                const size_t offset = y * stride + x * m_channels;
+                if (changed[x / TILE])
+                    delta_pixels(frame + offset, m_before.data() + offset, end - x, out);
+                else
+                    std::memset(out, 0, static_cast<size_t>(end - x) * 4);
+                out += static_cast<size_t>(end - x) * 4;
+                x = end;
+            }
+        }
+        return m_packed;
+    }
+
+    // Forget the previous frame, e.g. after the terminal lost the image.
+    auto reset() -> void {
+        m_valid = false;
+    }
+
+private:
+    [[nodiscard]] auto tiles_x() const -> int {
+        return (m_width + TILE - 1) / TILE;
+    }
+
+    [[nodiscard]] auto tiles_y() const -> int {
+        return (m_height + TILE - 1) / TILE;
+    }
+
+    auto tile_changed(const uint8_t *frame, int tx, int y, int h, size_t stride) const
+        -> bool {
+        const int x = tx * TILE;
+        const size_t bytes =
+            static_cast<size_t>(std::min(TILE, m_width - x)) * m_channels;
+        size_t offset = y * stride + x * m_channels;
+        for (int row = 0; row < h; row++, offset += stride) {
+            if (std::memcmp(frame + offset, m_previous.data() + offset, bytes) != 0)
+                return true;
+        }
+        return false;
+    }
+
+    auto copy_back(const uint8_t *frame, int x, int y, int w, int h, size_t stride)
+        -> void {
+        size_t offset = y * stride + x * m_channels;
+        for (int row = 0; row < h; row++, offset += stride) {
+            if (!m_before.empty())
+                std::memcpy(m_before.data() + offset, m_previous.data() + offset,
+                            w * m_channels);
+            std::memcpy(m_previous.data() + offset, frame + offset, w * m_channels);
+        }
+    }
+
+    auto delta_pixels(const uint8_t *frame, const uint8_t *before, int count,
+                      uint8_t *out) const -> void {
+        if (m_channels == 4) {
+            // compare whole pixels as words; the alpha byte is set by position so the
+            // byte order does not matter
+            for (int i = 0; i < count; i++, out += 4) {
+                uint32_t now, then;
+                std::memcpy(&now, frame + i * 4, 4);
+                std::memcpy(&then, before + i * 4, 4);
+                if (now == then) {
+                    std::memset(out, 0, 4);
+                } else {
+                    std::memcpy(out, &now, 4);
+                    out[3] = 255;
+                }
+            }
+            return;
+        }
+        for (int i = 0; i < count; i++, frame += m_channels, before += m_channels) {
+            uint8_t *px = out + i * 4;
+            if (std::memcmp(frame, before, m_channels) == 0) {
+                std::memset(px, 0, 4);
+            } else {
+                std::memcpy(px, frame, 3);
+                px[3] = 255;
+            }
+        }
+    }
+
+    // Grows an open rectangle from the tile row above with the same extent, otherwise
+    // starts a new one. Rectangles at index >= `open_before` belong to this tile row.
+    auto add_run(int x, int y, int w, int h, size_t open_before) -> void {
+        for (size_t i = 0; i < open_before; i++) {
+            Rect &r = m_open[i];
+            if (r.x == x && r.w == w && r.y + r.h == y) {
+                r.h += h;
+                return;
+            }
+        }
+        m_open.push_back({x, y, w, h});
+    }
+
+    // Open rectangles that did not grow into the tile row ending at `bottom` are final.
+    auto close_runs(int bottom) -> void {
+        size_t kept = 0;
+        for (size_t i = 0; i < m_open.size(); i++) {
+            if (m_open[i].y + m_open[i].h == bottom)
+                m_open[kept++] = m_open[i];
+            else
+                m_rects.push_back(m_open[i]);
+        }
+        m_open.resize(kept);
+    }
+
+    auto collapse() -> void {
+        Rect box = m_rects.front();
+        for (const Rect &r : m_rects) {
+            int x1 = std::max(box.x + box.w, r.x + r.w);
+            int y1 = std::max(box.y + box.h, r.y + r.h);
+            box.x = std::min(box.x, r.x);
+            box.y = std::min(box.y, r.y);
+            box.w = x1 - box.x;
+            box.h = y1 - box.y;
+        }
+        m_rects.clear();
+        m_rects.push_back(box);
+    }
+
+    int m_width;
+    int m_height;
+    int m_channels;
+    bool m_valid = false;
+    std::vector<uint8_t> m_previous;
+    std::vector<uint8_t> m_before;  // what changed tiles held before, with `deltas`
+    std::vector<uint8_t> m_changed; // per tile, set by the last update()
+    std::vector<Rect> m_rects;
+    std::vector<Rect> m_open;
+    std::vector<uint8_t> m_packed;
+};
@@ -0,0 +1,690 @@
+#pragma once
+
+#include "base64.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+/*
+ * Receiving end of the graphics protocol, standing in for kitty or ghostty in tests. It
+ * parses what a client writes to its tty: `ESC _G ... ESC \` commands, chunked ones
+ * (m=1) included, and the few CSI queries the client sends (primary device attributes,
+ * the 14t/16t/18t size reports, DECRQM and the mouse modes). Everything else, text and
+ * cursor movement, is ignored.
+ *
+ * Graphics commands are carried out the way graphics_protocol.rst says, short of
+ * drawing anything: the payload is base64 decoded, read from a file, temp file or shared
+ * memory object for t=f/t/s (which are unlinked as the spec asks), inflated for o=z and
+ * decoded for f=100, then stored per image id with its frames. a=f edits are blended or
+ * replaced into their frame, so the stored image is what a real terminal would show.
+ * Replies (OK or an error) go out as the spec describes, honouring q=1 and q=2.
+ *
+ * Every command is timed from the read that brought its first chunk to its reply (ack
+ * latency) and for the work done on it (decode cost). Frames are the commands that
+ * carried pixels and were acknowledged, which for FramePipeline is one per frame.
+ */
+class FakeTerminal {
+public:
+    struct Geometry {
+        int cols = 80;
+        int rows = 24;
+        int cell_width = 10;
+        int cell_height = 20;
+    };
+
+    struct Image {
+        int width = 0;
+        int height = 0;
+        std::vector<std::vector<uint8_t>> frames; // RGBA, the root frame first
+    };
+
+    struct Stats {
+        uint64_t bytes = 0;    // everything the client wrote
+        uint64_t payload = 0;  // base64 bytes inside graphics commands
+        uint64_t chunks = 0;   // escape codes, counting every chunk
+        uint64_t commands = 0; // complete graphics commands
+        uint64_t frames = 0;   // acknowledged commands that carried pixels
+        uint64_t errors = 0;
+        std::string last_error;
+        LatencyHistogram decode; // base64, medium, inflate, PNG and compositing
+        LatencyHistogram ack;    // first chunk read until the reply is written
+    };
+
+    using ReplyFn = std::function<void(std::string_view)>;
+
+    FakeTerminal(Geometry geometry, ReplyFn reply)
+        : m_geometry(geometry), m_reply(std::move(reply)) {
+        m_apc.reserve(8192);
+        m_data.reserve(1 << 20);
+        inflateInit(&m_inflate);
+    }
+
+    FakeTerminal(const FakeTerminal &) = delete;
+    FakeTerminal &operator=(const FakeTerminal &) = delete;
+
+    ~FakeTerminal() {
+        inflateEnd(&m_inflate);
+    }
+
+    // Parses `size` bytes the client wrote; replies are sent before this returns.
+    auto feed(const char *data, size_t size) -> void {
+        m_now = std::chrono::steady_clock::now();
+        m_stats.bytes += size;
+        const char *end = data + size;
+        while (data < end) {
+            if (m_state == State::Apc) {
+                // bulk of the traffic: copy up to the next ESC in one go
+                const char *esc =
+                    static_cast<const char *>(std::memchr(data, '\x1B', end - data));
+                m_apc.append(data, esc ? esc : end);
+                if (!esc)
+                    return;
+                data = esc + 1;
+                m_state = State::ApcEsc;
+                continue;
+            }
+            step(*data++);
+        }
+    }
+
+    [[nodiscard]] auto stats() const -> const Stats & {
+        return m_stats;
+    }
+
+    // Mouse modes the client turned on: any motion reports (1003), in pixels (1016).
+    [[nodiscard]] auto mouse_motion() const -> bool {
+        return m_mouse_motion;
+    }
+
+    [[nodiscard]] auto sgr_pixels() const -> bool {
+        return m_sgr_pixels;
+    }
+
+    // Image most recently transmitted or edited, even if it was deleted since (clients
+    // delete their images on exit), nullptr if there is none.
+    [[nodiscard]] auto last_image() const -> const Image * {
+        auto it = m_images.find(m_last_id);
+        if (it != m_images.end())
+            return &it->second;
+        return m_removed.frames.empty() ? nullptr : &m_removed;
+    }
+
+    // Writes the root frame of last_image() as a binary PPM, dropping alpha.
+    auto dump_ppm(const char *path) const -> bool {
+        const Image *image = last_image();
+        if (!image || image->frames.empty())
+            return false;
+        FILE *out = std::fopen(path, "wb");
+        if (!out)
+            return false;
+        std::fprintf(out, "P6\n%d %d\n255\n", image->width, image->height);
+        const std::vector<uint8_t> &rgba = image->frames.front();
+        std::vector<uint8_t> row(static_cast<size_t>(image->width) * 3);
+        for (int y = 0; y < image->height; y++) {
+            const uint8_t *src = rgba.data() + static_cast<size_t>(y) * image->width * 4;
+            for (int x = 0; x < image->width; x++)
+                std::memcpy(row.data() + x * 3, src + x * 4, 3);
+            std::fwrite(row.data(), 1, row.size(), out);
+        }
+        return std::fclose(out) == 0;
+    }
+
+private:
+    enum class State { Ground, Esc, Csi, Apc, ApcEsc };
+
+    // Keys of one command. Values are numbers or, for a=, t=, o=, d= and the like, the
+    // character itself.
+    struct Keys {
+        std::array<int64_t, 128> value{};
+        std::array<bool, 128> present{};
+
+        [[nodiscard]] auto get(char key, int64_t fallback = 0) const -> int64_t {
+            return present[static_cast<uint8_t>(key)] ? value[static_cast<uint8_t>(key)]
+                                                      : fallback;
+        }
+
+        auto set(char key, int64_t v) -> void {
+            value[static_cast<uint8_t>(key)] = v;
+            present[static_cast<uint8_t>(key)] = true;
+        }
+    };
+
+    auto step(char c) -> void {
+        switch (m_state) {
+        case State::Ground:
+            if (c == '\x1B')
+                m_state = State::Esc;
+            break;
+        case State::Esc:
+            if (c == '_') {
+                m_state = State::Apc;
+                m_apc.clear();
+                m_apc_start = m_now;
+            } else if (c == '[') {
+                m_state = State::Csi;
+                m_csi.clear();
+            } else {
+                m_state = State::Ground;
+            }
+            break;
+        case State::Csi:
+            if (c >= 0x40 && c <= 0x7E) {
+                m_state = State::Ground;
+                csi(c);
+            } else if (m_csi.size() < 32) {
+                m_csi += c;
+            }
+            break;
+        case State::Apc: m_apc += c; break;
+        case State::ApcEsc:
+            if (c == '\\') {
+                m_state = State::Ground;
+                if (!m_apc.empty() && m_apc[0] == 'G')
+                    graphics(std::string_view(m_apc).substr(1));
+            } else {
+                // an ESC that does not end the string cancels it and starts a new
+                // sequence
+                m_state = State::Esc;
+                step(c);
+            }
+            break;
+        }
+    }
+
+    auto csi(char final) -> void {
+        char reply[64];
+        int length = 0;
+        const Geometry &g = m_geometry;
+        if (final == 'c' && (m_csi.empty() || m_csi == "0")) {
+            length = std::snprintf(reply, sizeof(reply), "\x1B[?62;c");
+        } else if (final == 't' && m_csi == "14") {
+            length = std::snprintf(reply, sizeof(reply), "\x1B[4;%d;%dt",
+                                   g.rows * g.cell_height, g.cols * g.cell_width);
+        } else if (final == 't' && m_csi == "16") {
+            length = std::snprintf(reply, sizeof(reply), "\x1B[6;%d;%dt", g.cell_height,
+                                   g.cell_width);
+        } else if (final == 't' && m_csi == "18") {
+            length = std::snprintf(reply, sizeof(reply), "\x1B[8;%d;%dt", g.rows, g.cols);
+        } else if (final == 'p' && m_csi.starts_with('?') && m_csi.ends_with('$')) {
+            // DECRQM: 1 set, 2 reset, 0 unknown
+            const std::string_view mode =
+                std::string_view(m_csi).substr(1, m_csi.size() - 2);
+            const int state = mode == "1016" ? (m_sgr_pixels ? 1 : 2)
+                              : mode == "1003" ? (m_mouse_motion ? 1 : 2)
+                                               : 0;
+            length = std::snprintf(reply, sizeof(reply), "\x1B[?%.*s;%d$y",
+                                   static_cast<int>(mode.size()), mode.data(), state);
+        } else if ((final == 'h' || final == 'l') && m_csi.starts_with('?')) {
+            // several modes may be set at once, e.g. ?1003;1006h
+            std::string_view modes = std::string_view(m_csi).substr(1);
+            while (!modes.empty()) {
+                const size_t semi = modes.find(';');
+                const std::string_view mode = modes.substr(0, semi);
+                if (mode == "1003")
+                    m_mouse_motion = final == 'h';
+                else if (mode == "1016")
+                    m_sgr_pixels = final == 'h';
+                modes = semi == std::string_view::npos ? std::string_view()
+                                                       : modes.substr(semi + 1);
+            }
+        }
+        if (length > 0)
+            m_reply({reply, static_cast<size_t>(length)});
+    }
+
+    auto graphics(std::string_view body) -> void {
+        m_stats.chunks++;
+        const size_t semi = body.find(';');
+        std::string_view keys = body.substr(0, semi);
+        std::string_view payload =
+            semi == std::string_view::npos ? std::string_view() : body.substr(semi + 1);
+
+        Keys chunk;
+        parse_keys(keys, chunk);
+        if (!m_chunked) {
+            m_keys = chunk;
+            m_data.clear();
+            m_decode_ns = 0;
+            m_start = m_apc_start;
+            m_bad_payload = false;
+        } else if (chunk.present['q']) {
+            m_keys.set('q', chunk.get('q'));
+        }
+
+        // chunks other than the last are whole base64 groups, so each decodes on its own
+        const auto start = std::chrono::steady_clock::now();
+        m_stats.payload += payload.size();
+        const size_t offset = m_data.size();
+        m_data.resize(offset + payload.size() / 4 * 3 + 3);
+        const int decoded = base64_decode(payload.size(), payload.data(),
+                                          m_data.size() - offset, m_data.data() + offset);
+        m_data.resize(offset + std::max(decoded, 0));
+        if (decoded < 0)
+            m_bad_payload = true;
+        m_decode_ns += elapsed_ns(start);
+
+        m_chunked = chunk.get('m') == 1;
+        if (!m_chunked)
+            execute();
+    }
+
+    static auto parse_keys(std::string_view keys, Keys &out) -> void {
+        while (!keys.empty()) {
+            const size_t comma = keys.find(',');
+            const std::string_view kv = keys.substr(0, comma);
+            if (kv.size() > 2 && kv[1] == '=' && static_cast<uint8_t>(kv[0]) < 128) {
+                std::string_view value = kv.substr(2);
+                const bool negative = value[0] == '-';
+                if (negative)
+                    value.remove_prefix(1);
+                if (!value.empty() && value[0] >= '0' && value[0] <= '9') {
+                    int64_t number = 0;
+                    for (char c : value) {
+                        if (c < '0' || c > '9')
+                            break;
+                        number = number * 10 + (c - '0');
+                    }
+                    out.set(kv[0], negative ? -number : number);
+                } else if (!value.empty()) {
+                    out.set(kv[0], value[0]);
+                }
+            }
+            keys = comma == std::string_view::npos ? std::string_view()
+                                                   : keys.substr(comma + 1);
+        }
+    }
+
+    // Carries out the complete command in m_keys/m_data and replies.
+    auto execute() -> void {
+        m_stats.commands++;
+        const auto start = std::chrono::steady_clock::now();
+        const char action = static_cast<char>(m_keys.get('a', 't'));
+        const auto id = static_cast<uint32_t>(m_keys.get('i'));
+        std::string error;
+        bool pixels = false;
+
+        if (m_bad_payload) {
+            error = "EINVAL:Invalid base64 payload";
+        } else if (action == 't' || action == 'T' || action == 'q') {
+            pixels = true;
+            error = load();
+            if (error.empty() && action != 'q' && id) {
+                Image &image = m_images[id];
+                image.width = m_width;
+                image.height = m_height;
+                image.frames.assign(1, m_pixels);
+                m_last_id = id;
+            }
+        } else if (action == 'f') {
+            pixels = true;
+            error = edit_frame(id);
+        } else if (action == 'p' || action == 'a' || action == 'c') {
+            if (!m_images.contains(id))
+                error = "ENOENT:No image with id " + std::to_string(id);
+        } else if (action == 'd') {
+            remove();
+            return; // deletions are not answered
+        } else {
+            error = std::string("EINVAL:Unknown action ") + action;
+        }
+        m_decode_ns += elapsed_ns(start);
+        if (pixels)
+            m_stats.decode.record(m_decode_ns);
+
+        if (!error.empty()) {
+            m_stats.errors++;
+            m_stats.last_error = error;
+        }
+        const int64_t quiet = m_keys.get('q');
+        if (id == 0 || quiet >= 2 || (quiet == 1 && error.empty()))
+            return;
+
+        char head[48];
+        int length = std::snprintf(head, sizeof(head), "\x1B_Gi=%u", id);
+        if (m_keys.present['p'])
+            length += std::snprintf(head + length, sizeof(head) - length, ",p=%u",
+                                    static_cast<uint32_t>(m_keys.get('p')));
+        m_message.assign(head, length);
+        m_message += ';';
+        m_message += error.empty() ? "OK" : error;
+        m_message += "\x1B\\";
+        m_reply(m_message);
+        m_stats.ack.record(elapsed_ns(m_start));
+        if (pixels && error.empty())
+            m_stats.frames++;
+    }
+
+    // Resolves the medium, inflates and decodes m_data into m_pixels (RGBA), m_width x
+    // m_height. Returns an error message, empty on success.
+    auto load() -> std::string {
+        std::span<const uint8_t> data = m_data;
+        const char medium = static_cast<char>(m_keys.get('t', 'd'));
+        if (medium != 'd') {
+            std::string error = read_medium(medium);
+            if (!error.empty())
+                return error;
+            data = m_raw;
+        }
+
+        const int64_t format = m_keys.get('f', 32);
+        if (format != 24 && format != 32 && format != 100)
+            return "EINVAL:Unknown format " + std::to_string(format);
+        const int64_t width = m_keys.get('s');
+        const int64_t height = m_keys.get('v');
+        const size_t bpp = format == 24 ? 3 : 4;
+        if (format != 100 && (width <= 0 || height <= 0))
+            return "EINVAL:Missing image size";
+        const size_t expected = format == 100 ? 0 : width * height * bpp;
+
+        if (m_keys.get('o') == 'z') {
+            if (!inflate_into(data, m_inflated, expected))
+                return "EINVAL:Failed to inflate";
+            data = m_inflated;
+        }
+        if (format == 100)
+            return decode_png(data);
+
+        if (data.size() < expected)
+            return "ENODATA:Insufficient image data";
+        m_width = static_cast<int>(width);
+        m_height = static_cast<int>(height);
+        m_pixels.resize(static_cast<size_t>(width) * height * 4);
+        if (bpp == 4) {
+            std::memcpy(m_pixels.data(), data.data(), m_pixels.size());
+        } else {
+            for (size_t i = 0, o = 0; o < m_pixels.size(); i += 3, o += 4) {
+                std::memcpy(m_pixels.data() + o, data.data() + i, 3);
+                m_pixels[o + 3] = 255;
+            }
+        }
+        return {};
+    }
+
+    // t=f, t=t and t=s: m_data is the path or object name; S= and O= pick a range.
+    auto read_medium(char medium) -> std::string {
+        const std::string name(m_data.begin(), m_data.end());
+        int fd = medium == 's' ? shm_open(name.c_str(), O_RDONLY, 0)
+                               : open(name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return "EBADF:Failed to open " + name + ": " + std::strerror(errno);
+        struct stat st = {};
+        if (fstat(fd, &st) != 0 || (medium != 's' && !S_ISREG(st.st_mode))) {
+            close(fd);
+            return "EBADF:Not a regular file: " + name;
+        }
+        const auto offset = static_cast<size_t>(m_keys.get('O'));
+        const size_t file_size = static_cast<size_t>(st.st_size);
+        const size_t size = m_keys.present['S'] ? static_cast<size_t>(m_keys.get('S'))
+                                                : file_size - std::min(offset, file_size);
+        std::string error;
+        if (offset + size > file_size) {
+            error = "EINVAL:Range past the end of " + name;
+        } else if (size > 0) {
+            void *map = mmap(nullptr, offset + size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+                error = "EBADF:Failed to map " + name + ": " + std::strerror(errno);
+            } else {
+                const auto *bytes = static_cast<const uint8_t *>(map) + offset;
+                m_raw.assign(bytes, bytes + size);
+                munmap(map, offset + size);
+            }
+        } else {
+            m_raw.clear();
+        }
+        close(fd);
+
+        // the terminal owns shared memory and temp files once it was handed them
+        if (medium == 's')
+            shm_unlink(name.c_str());
+        else if (medium == 't' && name.find("tty-graphics-protocol") != std::string::npos)
+            unlink(name.c_str());
+        return error;
+    }
+
+    // Inflates a zlib stream into `out`. `expected` is the exact size when known; 0 grows
+    // the buffer as needed.
+    auto inflate_into(std::span<const uint8_t> in, std::vector<uint8_t> &out,
+                      size_t expected) -> bool {
+        inflateReset(&m_inflate);
+        out.resize(expected ? expected : std::max<size_t>(in.size() * 4, 4096));
+        m_inflate.next_in = const_cast<Bytef *>(in.data());
+        m_inflate.avail_in = static_cast<uInt>(in.size());
+        size_t produced = 0;
+        for (;;) {
+            m_inflate.next_out = out.data() + produced;
+            m_inflate.avail_out = static_cast<uInt>(out.size() - produced);
+            const int ret = inflate(&m_inflate, Z_FINISH);
+            produced = out.size() - m_inflate.avail_out;
+            if (ret == Z_STREAM_END)
+                break;
+            // only a full output buffer is worth retrying, and only without a known size
+            if ((ret != Z_BUF_ERROR && ret != Z_OK) || expected || m_inflate.avail_out)
+                return false;
+            out.resize(out.size() * 2);
+        }
+        out.resize(produced);
+        return !expected || produced == expected;
+    }
+
+    // 8 bit truecolor PNGs, with or without alpha, as the senders here write them.
+    auto decode_png(std::span<const uint8_t> png) -> std::string {
+        static constexpr uint8_t SIGNATURE[] = {0x89, 'P',  'N',  'G',
+                                                '\r', '\n', 0x1a, '\n'};
+        if (png.size() < 8 || std::memcmp(png.data(), SIGNATURE, 8) != 0)
+            return "EINVAL:Not a PNG";
+        int width = 0;
+        int height = 0;
+        int channels = 0;
+        m_idat.clear();
+        for (size_t pos = 8; pos + 12 <= png.size();) {
+            const uint32_t length = get_u32(png.data() + pos);
+            const uint8_t *type = png.data() + pos + 4;
+            const uint8_t *data = type + 4;
+            if (pos + 12 + length > png.size())
+                return "EINVAL:Truncated PNG";
+            if (std::memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+                width = static_cast<int>(get_u32(data));
+                height = static_cast<int>(get_u32(data + 4));
+                if (data[8] != 8 || (data[9] != 2 && data[9] != 6) || data[12] != 0)
+                    return "EINVAL:Unsupported PNG type";
+                channels = data[9] == 6 ? 4 : 3;
+            } else if (std::memcmp(type, "IDAT", 4) == 0) {
+                m_idat.insert(m_idat.end(), data, data + length);
+            } else if (std::memcmp(type, "IEND", 4) == 0) {
+                break;
+            }
+            pos += 12 + length;
+        }
+        if (width <= 0 || height <= 0)
+            return "EINVAL:PNG without IHDR";
+
+        const size_t row = static_cast<size_t>(width) * channels;
+        if (!inflate_into(m_idat, m_inflated, (row + 1) * height))
+            return "EINVAL:Corrupt PNG data";
+        m_width = width;
+        m_height = height;
+        m_pixels.resize(static_cast<size_t>(width) * height * 4);
+        std::vector<uint8_t> &rows = m_inflated;
+        for (int y = 0; y < height; y++) {
+            uint8_t *line = rows.data() + y * (row + 1) + 1;
+            const uint8_t *above = y ? line - (row + 1) : nullptr;
+            if (!unfilter(line[-1], line, above, row, channels))
+                return "EINVAL:Unknown PNG filter";
+            uint8_t *out = m_pixels.data() + static_cast<size_t>(y) * width * 4;
+            for (int x = 0; x < width; x++) {
+                std::memcpy(out + x * 4, line + x * channels, 3);
+                out[x * 4 + 3] = channels == 4 ? line[x * channels + 3] : 255;
+            }
+        }
+        return {};
+    }
+
+    static auto unfilter(uint8_t filter, uint8_t *line, const uint8_t *above,
+                         size_t bytes, int bpp) -> bool {
+        for (size_t i = 0; i < bytes; i++) {
+            const int a = i >= static_cast<size_t>(bpp) ? line[i - bpp] : 0;
+            const int b = above ? above[i] : 0;
+            const int c = above && i >= static_cast<size_t>(bpp) ? above[i - bpp] : 0;
+            int predicted;
+            switch (filter) {
+            case 0: predicted = 0; break;
+            case 1: predicted = a; break;
+            case 2: predicted = b; break;
+            case 3: predicted = (a + b) / 2; break;
+            case 4: {
+                const int p = a + b - c;
+                const int pa = std::abs(p - a);
+                const int pb = std::abs(p - b);
+                const int pc = std::abs(p - c);
+                predicted = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                break;
+            }
+            default: return false;
+            }
+            line[i] = static_cast<uint8_t>(line[i] + predicted);
+        }
+        return true;
+    }
+
+    // a=f: edits frame r= (1 based) of image i=, or adds a frame based on frame c=. The
+    // rectangle at x=, y= replaces the pixels with X=1 and is alpha blended otherwise.
+    auto edit_frame(uint32_t id) -> std::string {
+        auto it = m_images.find(id);
+        if (it == m_images.end())
+            return "ENOENT:No image with id " + std::to_string(id);
+        Image &image = it->second;
+
+        const bool has_data = !m_data.empty();
+        if (has_data) {
+            std::string error = load();
+            if (!error.empty())
+                return error;
+        }
+
+        const int64_t edit = m_keys.get('r');
+        std::vector<uint8_t> *frame;
+        if (edit > 0) {
+            if (static_cast<size_t>(edit) > image.frames.size())
+                return "ENOENT:No frame " + std::to_string(edit);
+            frame = &image.frames[edit - 1];
+        } else {
+            const int64_t base = m_keys.get('c');
+            if (base < 0 || static_cast<size_t>(base) > image.frames.size())
+                return "ENOENT:No frame " + std::to_string(base);
+            std::vector<uint8_t> next = base > 0 ? image.frames[base - 1]
+                                                 : std::vector<uint8_t>(
+                                                       static_cast<size_t>(image.width) *
+                                                       image.height * 4);
+            image.frames.push_back(std::move(next));
+            frame = &image.frames.back();
+        }
+        m_last_id = id;
+        if (!has_data)
+            return {};
+
+        const int64_t x0 = m_keys.get('x');
+        const int64_t y0 = m_keys.get('y');
+        if (x0 < 0 || y0 < 0 || x0 + m_width > image.width ||
+            y0 + m_height > image.height)
+            return "EINVAL:Rectangle out of bounds";
+        const bool replace = m_keys.get('X') == 1;
+        for (int y = 0; y < m_height; y++) {
+            const uint8_t *src = m_pixels.data() + static_cast<size_t>(y) * m_width * 4;
+            uint8_t *dst =
+                frame->data() + ((y0 + y) * static_cast<size_t>(image.width) + x0) * 4;
+            if (replace) {
+                std::memcpy(dst, src, static_cast<size_t>(m_width) * 4);
+                continue;
+            }
+            for (int x = 0; x < m_width; x++, src += 4, dst += 4) {
+                const int alpha = src[3];
+                if (alpha == 255) {
+                    std::memcpy(dst, src, 4);
+                } else if (alpha) {
+                    for (int c = 0; c < 3; c++)
+                        dst[c] = static_cast<uint8_t>(
+                            (src[c] * alpha + dst[c] * (255 - alpha) + 127) / 255);
+                    dst[3] = static_cast<uint8_t>(alpha + dst[3] * (255 - alpha) / 255);
+                }
+            }
+        }
+        return {};
+    }
+
+    // a=d: d=a/A and d=i/I; the other targets only remove placements, which are not kept.
+    auto remove() -> void {
+        const char target = static_cast<char>(m_keys.get('d', 'a'));
+        const bool all = target == 'a' || target == 'A';
+        if (!all && target != 'i' && target != 'I')
+            return;
+        const auto id = all ? m_last_id : static_cast<uint32_t>(m_keys.get('i'));
+        auto it = m_images.find(id);
+        if (id == m_last_id && it != m_images.end())
+            m_removed = std::move(it->second);
+        if (all)
+            m_images.clear();
+        else if (it != m_images.end())
+            m_images.erase(it);
+    }
+
+    static auto get_u32(const uint8_t *p) -> uint32_t {
+        return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 |
+               static_cast<uint32_t>(p[2]) << 8 | p[3];
+    }
+
+    static auto elapsed_ns(std::chrono::steady_clock::time_point since) -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - since)
+            .count();
+    }
+
+    Geometry m_geometry;
+    ReplyFn m_reply;
+    Stats m_stats;
+
+    // parser
+    State m_state = State::Ground;
+    std::string m_apc;
+    std::string m_csi;
+    std::chrono::steady_clock::time_point m_now;
+    std::chrono::steady_clock::time_point m_apc_start;
+    bool m_mouse_motion = false;
+    bool m_sgr_pixels = false;
+
+    // command being received
+    Keys m_keys;
+    bool m_chunked = false;
+    bool m_bad_payload = false;
+    std::vector<uint8_t> m_data;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_decode_ns = 0;
+    std::string m_message;
+
+    // decoding scratch
+    z_stream m_inflate = {};
+    std::vector<uint8_t> m_raw;
+    std::vector<uint8_t> m_inflated;
+    std::vector<uint8_t> m_idat;
+    std::vector<uint8_t> m_pixels;
+    int m_width = 0;
+    int m_height = 0;
+
+    std::map<uint32_t, Image> m_images;
+    uint32_t m_last_id = 0;
+    Image m_removed; // the image of m_last_id once it was deleted
+};
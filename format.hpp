@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/*
+ * Pixel formats frames can be read back and sent in. The GUI renders into an opaque
+ * frame buffer, so the alpha channel of RGBA (f=32) carries nothing and RGB (f=24) saves
+ * a quarter of the bytes before compression. That holds for full uploads and for changed
+ * rectangles with KGP_DELTA=off only: the delta modes need the alpha channel for their
+ * mask, so their edits go out as RGBA whatever the format (see delta.hpp).
+ *
+ * Palette is experimental and lossy: every pixel is snapped to the nearest entry of a
+ * small palette (the colors of the ImGui style) and sent as RGB. Antialiased edges lose
+ * their in-between shades, but the long runs of identical pixels compress much better.
+ */
+enum class PixelFormat { RGBA, RGB, Palette };
+
+[[nodiscard]] inline auto pixel_format_channels(PixelFormat format) -> int {
+    return format == PixelFormat::RGBA ? 4 : 3;
+}
+
+// Value of the `f=` key.
+[[nodiscard]] inline auto pixel_format_key(PixelFormat format) -> int {
+    return format == PixelFormat::RGBA ? 32 : 24;
+}
+
+[[nodiscard]] inline auto pixel_format_name(PixelFormat format) -> const char * {
+    switch (format) {
+    case PixelFormat::RGBA: return "rgba";
+    case PixelFormat::RGB: return "rgb";
+    case PixelFormat::Palette: return "palette";
+    }
+    return "?";
+}
+
+// KGP_FORMAT=rgba|rgb|palette, RGBA by default.
+inline auto pixel_format_from_env() -> PixelFormat {
+    const char *env = std::getenv("KGP_FORMAT");
+    if (!env)
+        return PixelFormat::RGBA;
+    for (auto format : {PixelFormat::RGBA, PixelFormat::RGB, PixelFormat::Palette}) {
+        if (std::string_view(env) == pixel_format_name(format))
+            return format;
+    }
+    std::cerr << "Unknown KGP_FORMAT " << env << ", using rgba\n";
+    return PixelFormat::RGBA;
+}
+
+/*
+ * Snaps RGB pixels to the nearest color of a palette of up to 256 entries. The nearest
+ * entry is looked up once for every 15 bit color when the quantizer is built, so
+ * applying it costs one table load per pixel.
+ */
+class PaletteQuantizer {
+public:
+    using Color = std::array<uint8_t, 3>;
+
+    explicit PaletteQuantizer(std::span<const Color> palette)
+        : m_palette(palette.begin(),
+                    palette.begin() + std::min<size_t>(palette.size(), 256)),
+          m_lut(1 << 15) {
+        if (m_palette.empty())
+            m_palette.push_back({0, 0, 0});
+        for (uint32_t key = 0; key < m_lut.size(); key++) {
+            // center of the 8x8x8 cell this key stands for
+            const int r = static_cast<int>((key >> 10) << 3 | 4);
+            const int g = static_cast<int>(((key >> 5) & 31) << 3 | 4);
+            const int b = static_cast<int>((key & 31) << 3 | 4);
+            int best = 0;
+            int best_distance = 1 << 30;
+            for (size_t i = 0; i < m_palette.size(); i++) {
+                const int dr = r - m_palette[i][0];
+                const int dg = g - m_palette[i][1];
+                const int db = b - m_palette[i][2];
+                // weighted roughly by how sensitive the eye is to each channel
+                const int distance = 3 * dr * dr + 4 * dg * dg + 2 * db * db;
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = static_cast<int>(i);
+                }
+            }
+            m_lut[key] = static_cast<uint8_t>(best);
+        }
+    }
+
+    // Builds the palette from `colors` (RGBA floats as in ImGuiStyle::Colors), each
+    // blended over the opaque `background`, plus a gray ramp for antialiased text.
+    static auto from_style(std::span<const std::array<float, 4>> colors,
+                           std::array<float, 3> background) -> PaletteQuantizer {
+        std::vector<Color> palette;
+        auto add = [&](float r, float g, float b) {
+            Color c = {to_byte(r), to_byte(g), to_byte(b)};
+            for (const Color &existing : palette) {
+                if (existing == c)
+                    return;
+            }
+            palette.push_back(c);
+        };
+        add(background[0], background[1], background[2]);
+        for (const auto &color : colors) {
+            const float a = color[3];
+            add(color[0] * a + background[0] * (1 - a),
+                color[1] * a + background[1] * (1 - a),
+                color[2] * a + background[2] * (1 - a));
+        }
+        for (int i = 0; i <= 8; i++)
+            add(i / 8.0f, i / 8.0f, i / 8.0f);
+        return PaletteQuantizer(palette);
+    }
+
+    // Replaces each of the `pixels` RGB pixels at `rgb` with its palette color.
+    auto apply(uint8_t *rgb, size_t pixels) const -> void {
+        for (size_t i = 0; i < pixels; i++, rgb += 3) {
+            const uint32_t key = (rgb[0] >> 3) << 10 | (rgb[1] >> 3) << 5 | rgb[2] >> 3;
+            const Color &color = m_palette[m_lut[key]];
+            rgb[0] = color[0];
+            rgb[1] = color[1];
+            rgb[2] = color[2];
+        }
+    }
+
+    [[nodiscard]] auto size() const -> size_t {
+        return m_palette.size();
+    }
+
+private:
+    static auto to_byte(float v) -> uint8_t {
+        return static_cast<uint8_t>(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+
+    std::vector<Color> m_palette;
+    std::vector<uint8_t> m_lut; // 15 bit color -> palette index
+};
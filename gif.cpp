@@ -0,0 +1,133 @@
+#include "animation.hpp"
+#include "assets.hpp"
+#include "gif.hpp"
+#include "kgp.hpp"
+#include "mapped_file.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * GIF player. The file is mapped, not read, and decoded a window of frames at a time:
+ * the first frame goes out on its own as soon as it is decoded, later ones in batches
+ * that are compressed in parallel while the terminal already plays what it has. Memory
+ * stays at `window` frames however long the GIF is.
+ *
+ * Once all frames are uploaded the terminal loops them by itself and this process only
+ * waits for a key press. With -c the frames are switched from here instead, for
+ * terminals that store frames but do not run animations.
+ *
+ * PNG files are shown as they are, the terminal decodes them.
+ */
+namespace {
+
+constexpr size_t DEFAULT_WINDOW = 8;
+
+auto usage(const char *name) -> int {
+    std::cerr << "Usage: " << name << " [-c] [-w frames] <gif_or_png_path>" << std::endl;
+    return 1;
+}
+
+auto show_png(const char *path) -> int {
+    setup_terminal();
+    uint32_t id;
+    {
+        KittyAssets assets(kitty_choose_transport());
+        id = assets.png_file(path);
+        if (id != 0) {
+            assets.place(id);
+            char key;
+            (void)!read(STDIN_FILENO, &key, 1);
+        }
+    } // deletes the image
+    restore_terminal();
+    return id != 0 ? 0 : EXIT_FAILURE;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bool client_driven = false;
+    size_t window = DEFAULT_WINDOW;
+    int arg = 1;
+    for (; arg < argc - 1; arg++) {
+        if (std::strcmp(argv[arg], "-c") == 0)
+            client_driven = true;
+        else if (std::strcmp(argv[arg], "-w") == 0 && arg + 2 < argc)
+            window = std::max(1, std::atoi(argv[++arg]));
+        else
+            return usage(argv[0]);
+    }
+    if (arg != argc - 1)
+        return usage(argv[0]);
+    const char *gif_path = argv[arg];
+
+    MappedFile file(gif_path);
+    if (!file)
+        return EXIT_FAILURE;
+    if (is_png(file.bytes()))
+        return show_png(gif_path);
+    GifDecoder decoder(file.bytes());
+    if (!decoder) {
+        std::cerr << "Failed to load GIF: " << gif_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // one extra slot holds the last frame of the previous batch for diffing
+    const size_t frame_size = static_cast<size_t>(decoder.width()) * decoder.height() * 4;
+    std::vector<uint8_t> frames((window + 1) * frame_size);
+    std::vector<int> delays(window);
+    uint8_t *previous = frames.data() + window * frame_size;
+    bool have_previous = false;
+
+    setup_terminal();
+    KittyAnimation animation(decoder.width(), decoder.height());
+
+    // the first batch is a single frame so something is on screen right away
+    for (size_t batch = 1;; batch = window) {
+        size_t count = 0;
+        while (count < batch &&
+               decoder.next(frames.data() + count * frame_size, delays[count]))
+            count++;
+        if (count == 0)
+            break;
+
+        animation.add_frames(frames.data(), count, delays.data(),
+                             have_previous ? previous : nullptr);
+        animation.upload();
+        if (!have_previous && !client_driven)
+            animation.play_loading();
+
+        std::memcpy(previous, frames.data() + (count - 1) * frame_size, frame_size);
+        have_previous = true;
+        if (count < batch)
+            break;
+    }
+    if (animation.frame_count() == 0) {
+        restore_terminal();
+        std::cerr << "No frames in " << gif_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (client_driven) {
+        // poll stdin between frames so a key press still ends playback
+        for (size_t i = 0;; i = (i + 1) % animation.frame_count()) {
+            animation.show(i);
+            pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+            if (poll(&pfd, 1, animation.gap_ms(i)) > 0)
+                break;
+        }
+    } else {
+        animation.play();
+        char key;
+        (void)!read(STDIN_FILENO, &key, 1);
+        animation.stop();
+    }
+
+    animation.image().remove();
+    restore_terminal();
+    return 0;
+}
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <span>
+#include <vector>
+
+/*
+ * Incremental GIF decoder over an in-memory (usually mmap'ed) file. Each call to next()
+ * decodes exactly one frame and composes it onto the canvas, so memory stays at a few
+ * canvas sized buffers no matter how many frames the file holds, and the first frame is
+ * ready as soon as its own bytes are decoded.
+ *
+ * Supports global and local color tables, transparency, interlacing and the three
+ * disposal methods. Frames come out fully composed as top-down RGBA.
+ */
+class GifDecoder {
+public:
+    explicit GifDecoder(std::span<const uint8_t> file) : m_file(file) {
+        if (m_file.size() < 13 || (std::memcmp(m_file.data(), "GIF87a", 6) != 0 &&
+                                   std::memcmp(m_file.data(), "GIF89a", 6) != 0)) {
+            std::cerr << "Not a GIF file\n";
+            m_failed = true;
+            return;
+        }
+        m_pos = 6;
+        m_width = u16();
+        m_height = u16();
+        const uint8_t packed = u8();
+        m_pos += 2; // background color index (disposal clears to transparent), aspect
+        if (m_width == 0 || m_height == 0) {
+            std::cerr << "GIF has no size\n";
+            m_failed = true;
+            return;
+        }
+        if (pixels() > MAX_PIXELS) {
+            std::cerr << "GIF is too large (" << m_width << "x" << m_height << ")\n";
+            m_failed = true;
+            return;
+        }
+        if (packed & 0x80)
+            m_global_colors = read_palette(packed, m_global);
+
+        m_canvas.assign(pixels() * 4, 0);
+        m_indices.resize(pixels());
+    }
+
+    explicit operator bool() const {
+        return !m_failed;
+    }
+
+    [[nodiscard]] auto width() const -> int {
+        return m_width;
+    }
+
+    [[nodiscard]] auto height() const -> int {
+        return m_height;
+    }
+
+    // True if decoding stopped on corrupt or truncated data rather than the trailer.
+    [[nodiscard]] auto failed() const -> bool {
+        return m_failed;
+    }
+
+    // Decodes the next frame into `rgba` (width * height * 4 bytes, top-down), composed
+    // onto the ones before it, and sets how long it stays on screen. Returns false after
+    // the last frame.
+    auto next(uint8_t *rgba, int &delay_ms) -> bool {
+        if (m_failed)
+            return false;
+        dispose();
+
+        while (m_pos < m_file.size()) {
+            switch (u8()) {
+            case 0x21: // extension
+                if (u8() == 0xF9 && peek() >= 4) {
+                    const size_t end = m_pos + 1 + u8();
+                    const uint8_t packed = u8();
+                    m_delay = u16() * 10; // hundredths of a second
+                    m_transparent = (packed & 1) ? u8() : -1;
+                    m_disposal = (packed >> 2) & 7;
+                    m_pos = end;
+                }
+                skip_sub_blocks();
+                break;
+            case 0x2C: // image descriptor
+                if (!decode_frame())
+                    return fail("Corrupt GIF frame");
+                std::memcpy(rgba, m_canvas.data(), m_canvas.size());
+                delay_ms = m_delay;
+                m_delay = 0;
+                m_transparent = -1;
+                return true;
+            case 0x3B: // trailer
+                return false;
+            default: return fail("Corrupt GIF block");
+            }
+        }
+        // truncated files still show what was there
+        return false;
+    }
+
+private:
+    struct Rect {
+        int x = 0, y = 0, w = 0, h = 0;
+    };
+
+    static constexpr int MAX_CODES = 4096;
+    // the header sizes every buffer, so it is not trusted beyond what stb_image allowed
+    static constexpr size_t MAX_PIXELS = 1 << 24;
+
+    [[nodiscard]] auto pixels() const -> size_t {
+        return static_cast<size_t>(m_width) * m_height;
+    }
+
+    auto fail(const char *message) -> bool {
+        std::cerr << message << " at offset " << m_pos << "\n";
+        m_failed = true;
+        return false;
+    }
+
+    // Reads past the end return 0; callers check m_pos against the size where it matters.
+    auto u8() -> uint8_t {
+        return m_pos < m_file.size() ? m_file[m_pos++] : (m_pos++, 0);
+    }
+
+    [[nodiscard]] auto peek() const -> uint8_t {
+        return m_pos < m_file.size() ? m_file[m_pos] : 0;
+    }
+
+    auto u16() -> int {
+        int lo = u8();
+        return lo | u8() << 8;
+    }
+
+    auto skip_sub_blocks() -> void {
+        for (uint8_t size; m_pos < m_file.size() && (size = u8()) != 0;)
+            m_pos += size;
+    }
+
+    auto read_palette(uint8_t packed, uint8_t *palette) -> int {
+        const int colors = 2 << (packed & 7);
+        for (int i = 0; i < colors; i++) {
+            palette[i * 4 + 0] = u8();
+            palette[i * 4 + 1] = u8();
+            palette[i * 4 + 2] = u8();
+            palette[i * 4 + 3] = 255;
+        }
+        return colors;
+    }
+
+    // Undoes the previous frame as its disposal method asks.
+    auto dispose() -> void {
+        const size_t stride = static_cast<size_t>(m_width) * 4;
+        for (int y = m_rect.y; y < m_rect.y + m_rect.h; y++) {
+            const size_t offset = y * stride + static_cast<size_t>(m_rect.x) * 4;
+            const size_t bytes = static_cast<size_t>(m_rect.w) * 4;
+            if (m_frame_disposal == 2) // restore to background
+                std::memset(m_canvas.data() + offset, 0, bytes);
+            else if (m_frame_disposal == 3) // restore to previous
+                std::memcpy(m_canvas.data() + offset, m_saved.data() + offset, bytes);
+        }
+        m_frame_disposal = 0;
+    }
+
+    auto decode_frame() -> bool {
+        Rect frame;
+        frame.x = u16();
+        frame.y = u16();
+        frame.w = u16();
+        frame.h = u16();
+        const uint8_t packed = u8();
+
+        uint8_t local[256 * 4];
+        const uint8_t *palette = m_global;
+        int colors = m_global_colors;
+        if (packed & 0x80) {
+            colors = read_palette(packed, local);
+            palette = local;
+        }
+        if (m_pos >= m_file.size())
+            return false;
+        // a frame must lie within the canvas, which also keeps it within m_indices
+        if (frame.x + frame.w > m_width || frame.y + frame.h > m_height)
+            return false;
+
+        const size_t count = static_cast<size_t>(frame.w) * frame.h;
+        if (!decode_lzw(count))
+            return false;
+
+        if (m_disposal == 3) {
+            m_saved.resize(m_canvas.size());
+            std::memcpy(m_saved.data(), m_canvas.data(), m_canvas.size());
+        }
+
+        // rows of interlaced frames come in four passes
+        static constexpr int PASS_START[] = {0, 4, 2, 1};
+        static constexpr int PASS_STEP[] = {8, 8, 4, 2};
+        const bool interlaced = packed & 0x40;
+        int pass = 0, row = 0;
+        for (int i = 0; i < frame.h; i++) {
+            if (interlaced) {
+                while (row >= frame.h && pass < 3) {
+                    pass++;
+                    row = PASS_START[pass];
+                }
+            } else {
+                row = i;
+            }
+            const int y = frame.y + row;
+            if (interlaced)
+                row += PASS_STEP[pass];
+
+            const uint8_t *src = m_indices.data() + static_cast<size_t>(i) * frame.w;
+            uint8_t *dst = m_canvas.data() + (static_cast<size_t>(y) * m_width) * 4;
+            for (int x = 0; x < frame.w; x++) {
+                const int index = src[x];
+                if (index == m_transparent)
+                    continue;
+                uint8_t *px = dst + static_cast<size_t>(frame.x + x) * 4;
+                if (index < colors) {
+                    std::memcpy(px, palette + index * 4, 4);
+                } else {
+                    px[0] = px[1] = px[2] = 0;
+                    px[3] = 255;
+                }
+            }
+        }
+
+        m_rect = frame;
+        m_frame_disposal = m_disposal;
+        m_disposal = 0;
+        return true;
+    }
+
+    // Decodes the image data sub-blocks into `count` palette indices. Missing pixels of
+    // a short stream are left at index 0.
+    auto decode_lzw(size_t count) -> bool {
+        const int min_size = u8();
+        if (min_size < 2 || min_size > 8)
+            return false;
+        const int clear = 1 << min_size;
+        const int end = clear + 1;
+        for (int i = 0; i < clear; i++) {
+            m_suffix[i] = static_cast<uint8_t>(i);
+            m_first[i] = static_cast<uint8_t>(i);
+            m_length[i] = 1;
+        }
+
+        int code_size = min_size + 1;
+        int next_code = clear + 2;
+        int previous = -1;
+        uint32_t bits = 0;
+        int bit_count = 0;
+        size_t block_left = 0;
+        size_t out = 0;
+        std::fill_n(m_indices.data(), count, 0);
+
+        for (;;) {
+            while (bit_count < code_size) {
+                if (block_left == 0) {
+                    block_left = u8();
+                    if (block_left == 0 || m_pos >= m_file.size())
+                        return true; // stream ended without an end code
+                }
+                bits |= static_cast<uint32_t>(u8()) << bit_count;
+                bit_count += 8;
+                block_left--;
+            }
+            const int code = static_cast<int>(bits & ((1u << code_size) - 1));
+            bits >>= code_size;
+            bit_count -= code_size;
+
+            if (code == clear) {
+                code_size = min_size + 1;
+                next_code = clear + 2;
+                previous = -1;
+                continue;
+            }
+            if (code == end)
+                break;
+            if (code > next_code || (previous < 0 && code >= clear))
+                return false;
+
+            if (previous >= 0 && next_code < MAX_CODES) {
+                // the new entry is the previous string plus the first byte of this one,
+                // which for the code being defined right now is the previous string's
+                const int first = code == next_code ? m_first[previous] : m_first[code];
+                m_prefix[next_code] = static_cast<uint16_t>(previous);
+                m_suffix[next_code] = static_cast<uint8_t>(first);
+                m_first[next_code] = m_first[previous];
+                m_length[next_code] = static_cast<uint16_t>(m_length[previous] + 1);
+                next_code++;
+                if (next_code == 1 << code_size && code_size < 12)
+                    code_size++;
+            } else if (code == next_code) {
+                return false;
+            }
+
+            // write the string back to front straight into place
+            const size_t length = m_length[code];
+            size_t pos = out + length;
+            for (int c = code; pos > out; c = m_prefix[c]) {
+                --pos;
+                if (pos < count)
+                    m_indices[pos] = m_suffix[c];
+            }
+            out += length;
+            previous = code;
+        }
+        m_pos += block_left; // rest of the block holding the end code
+        skip_sub_blocks();
+        return true;
+    }
+
+    std::span<const uint8_t> m_file;
+    size_t m_pos = 0;
+    bool m_failed = false;
+    int m_width = 0;
+    int m_height = 0;
+
+    uint8_t m_global[256 * 4] = {};
+    int m_global_colors = 0;
+
+    // graphic control extension of the frame about to be decoded
+    int m_delay = 0;
+    int m_transparent = -1;
+    int m_disposal = 0;
+    // the last frame, to be disposed before the next one
+    Rect m_rect;
+    int m_frame_disposal = 0;
+
+    std::vector<uint8_t> m_canvas;  // RGBA
+    std::vector<uint8_t> m_saved;   // canvas before a "restore to previous" frame
+    std::vector<uint8_t> m_indices; // palette indices of one frame
+
+    uint16_t m_prefix[MAX_CODES] = {};
+    uint8_t m_suffix[MAX_CODES] = {};
+    uint8_t m_first[MAX_CODES] = {};
+    uint16_t m_length[MAX_CODES] = {};
+};
@@ -1,19 +1,61 @@
 #include "imgui.h"
-#include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
-#include <OpenGL/glext.h>
+#include "imgui_internal.h"
+#include <algorithm>
+#include <cassert>
 #include <cstdio>
+#include <functional>
 #define GL_SILENCE_DEPRECATION
 #if defined(IMGUI_IMPL_OPENGL_ES2)
 #include <GLES2/gl2.h>
 #endif
+// GL 3 entry points (FBOs, fences, mapped PBOs) are exported by libGL on Linux, so they
+// are declared directly instead of going through a loader
+#ifndef __APPLE__
+#define GL_GLEXT_PROTOTYPES
+#endif
 #include <GLFW/glfw3.h> // Will drag system OpenGL headers
+#ifdef __APPLE__
 #include <OpenGL/gl.h>
+#include <OpenGL/glext.h>
+#else
+#include <GL/gl.h>
+#include <GL/glext.h>
+#endif
+#include <chrono>
+#include <context.hpp>
+#include <format.hpp>
+#include <input.hpp>
 #include <iostream>
 #include <kgp.hpp>
+#include <optional>
+#include <pacing.hpp>
+#include <pipeline.hpp>
+#include <pool.hpp>
+#include <raster.hpp>
+#include <stats.hpp>
 #include <sys/ioctl.h>
 #include <zlib.h>
 
+#ifdef KGP_COUNT_ALLOCATIONS
+// Counting replacements of the global allocation functions; the main loop asserts the
+// count stays flat once it reaches steady state.
+void *operator new(size_t size) {
+    g_heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+#endif
+
 void catch_sigint(int) {
     restore_terminal();
     std::cout << "\n"; // Add newline after terminal restore
@@ -22,150 +64,362 @@ void catch_sigint(int) {
 
 class GUI {
 public:
+    // cell size used when the terminal reports no pixel sizes at all
     static constexpr int CELL_WIDTH = 24;
     static constexpr int CELL_HEIGHT = 48;
     static constexpr int PADDING = 4;
+    // readbacks in flight: one being written by the GPU, one mapped by the consumer and
+    // a spare so the next glReadPixels never waits on either
+    static constexpr int PBO_COUNT = 3;
+    static constexpr GLuint64 FENCE_TIMEOUT_NS = 1'000'000'000;
+    // frames drawn after each input so hover and active states settle
+    static constexpr int REDRAW_FRAMES = 3;
+    // how often the stats overlay redraws while nothing else does
+    static constexpr double STATS_REFRESH_S = 0.5;
+
+    static constexpr ImVec4 CLEAR_COLOR = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+
+    // Rows of a finished readback, straight out of the mapped pixel buffer. Rows are
+    // top-down, as the terminal expects them.
+    struct PixelView {
+        const uint8_t *data = nullptr;
+        int width = 0;
+        int height = 0;
+        int channels = 4;
+
+        [[nodiscard]] auto size() const -> size_t {
+            return static_cast<size_t>(width) * height * channels;
+        }
 
-    GUI(int w, int h) : m_width(w), m_height(h) {
-        if (!glfwGetCurrentContext()) {
+        explicit operator bool() const {
+            return data != nullptr;
+        }
+    };
+
+    // Readbacks come out as RGB for the three channel formats; the frame buffer itself
+    // stays RGBA. With Renderer::Soft the frame is rasterized into memory instead and
+    // no GL call is made; the context may then be GLBackend::None.
+    GUI(OffscreenContext &context, int w, int h, int cols, int rows, PixelFormat format,
+        Renderer renderer)
+        : m_context(context), m_channels(pixel_format_channels(format)),
+          m_read_format(m_channels == 3 ? GL_RGB : GL_RGBA),
+          m_layer_list(ImGui::GetDrawListSharedData()) {
+        if (!m_context) {
             std::cerr << "No OpenGL context found\n";
             std::exit(EXIT_FAILURE);
         }
+        add_static_layer([this](ImDrawList &draw_list) { draw_grid(draw_list); });
+
+        if (renderer == Renderer::Soft) {
+            m_raster.emplace();
+            ImGuiIO &io = ImGui::GetIO();
+            io.BackendRendererName = "kgp_soft";
+            io.BackendFlags |= ImGuiBackendFlags_RendererHasVtxOffset;
+            unsigned char *atlas = nullptr;
+            io.Fonts->GetTexDataAsRGBA32(&atlas, &m_font.width, &m_font.height);
+            m_font.rgba = atlas;
+            io.Fonts->SetTexID(m_font.id());
+            resize(w, h, cols, rows);
+            return;
+        }
 
-        // initialize frame buffers
+        // frame buffer plus a second one that receives a vertically flipped blit of the
+        // first, so readbacks come out top-down and the CPU never has to flip rows
         glGenFramebuffers(1, &m_fbo);
-        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
-
-        // init render buffers
         glGenRenderbuffers(1, &m_rbo);
-        glBindRenderbuffer(GL_RENDERBUFFER, m_rbo);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
-
-        // attach render buffer to frame buffer
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
-                                  m_rbo);
-
-        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-            std::cerr << "Framebuffer is not complete!\n";
-            std::exit(EXIT_FAILURE);
-        }
-
-        glViewport(0, 0, m_width, m_height);
+        glGenFramebuffers(1, &m_flip_fbo);
+        glGenRenderbuffers(1, &m_flip_rbo);
+        // the static layers, copied into the frame buffer at the start of every frame
+        glGenFramebuffers(1, &m_layer_fbo);
+        glGenRenderbuffers(1, &m_layer_rbo);
+        // pixel buffers for asynchronous readback
+        glGenBuffers(PBO_COUNT, m_pbos);
+
+        resize(w, h, cols, rows);
     }
 
     ~GUI() {
+        if (m_raster)
+            return;
         glBindFramebuffer(GL_FRAMEBUFFER, 0); // reset to default frame buffer
 
+        if (m_mapped >= 0)
+            unmap_readback();
+        for (GLsync &fence : m_fences) {
+            if (fence)
+                glDeleteSync(fence);
+        }
+        glDeleteBuffers(PBO_COUNT, m_pbos);
+        glDeleteRenderbuffers(1, &m_flip_rbo);
+        glDeleteFramebuffers(1, &m_flip_fbo);
+        glDeleteRenderbuffers(1, &m_layer_rbo);
+        glDeleteFramebuffers(1, &m_layer_fbo);
+
         glDeleteRenderbuffers(1, &m_rbo);
         glDeleteFramebuffers(1, &m_fbo);
     }
 
-    auto frame() const -> void {
+    // Reallocates the render and pixel buffers for a `w` x `h` frame covering `cols` x
+    // `rows` terminal cells. Readbacks still in flight are dropped.
+    auto resize(int w, int h, int cols, int rows) -> void {
+        if (m_mapped >= 0)
+            unmap_readback();
+        for (GLsync &fence : m_fences) {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        m_pbo_head = 0;
+        m_pending = 0;
+
+        m_width = w;
+        m_height = h;
+        m_cols = cols;
+        m_rows = rows;
+        m_layers_dirty = true;
+
+        if (m_raster) {
+            m_pixels.resize(static_cast<size_t>(m_width) * m_height * 4);
+            m_background.resize(m_pixels.size());
+            if (m_channels == 3)
+                m_packed.resize(static_cast<size_t>(m_width) * m_height * 3);
+            request_redraw();
+            return;
+        }
+
+        attach_storage(m_fbo, m_rbo);
+        attach_storage(m_flip_fbo, m_flip_rbo);
+        attach_storage(m_layer_fbo, m_layer_rbo);
         glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        glViewport(0, 0, m_width, m_height);
 
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+        for (GLuint pbo : m_pbos) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER,
+                         static_cast<GLsizeiptr>(m_width) * m_height * m_channels,
+                         nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
 
-        // Set next window to be fullscreen
-        ImGui::SetNextWindowPos(ImVec2(0, 0));
-        ImGui::SetNextWindowSize(ImVec2(m_width, m_height));
-        ImGui::Begin("Demo", nullptr,
-                     ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
-                         ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoSavedSettings |
-                         ImGuiWindowFlags_NoBringToFrontOnFocus);
+        request_redraw();
+    }
 
-        ImDrawList *draw_list = ImGui::GetWindowDrawList();
+    // Adds a static layer: `draw` fills a draw list that is rendered once into a cached
+    // background, which every frame then starts from instead of the clear color. Only
+    // resize() and invalidate_layers() draw it again, so content that changes with the
+    // frame size alone costs nothing per frame. Layers stack in the order they were
+    // added, under all ImGui windows.
+    auto add_static_layer(std::function<void(ImDrawList &)> draw) -> void {
+        m_layers.push_back(std::move(draw));
+        invalidate_layers();
+    }
 
-        // Draw vertical lines at cell boundaries (every 24 pixels)
-        for (int x = 0; x < m_width; x += 24) {
-            draw_list->AddLine(ImVec2(x, 0), ImVec2(x, m_height),
-                               IM_COL32(255, 255, 255, 64) // dimmer lines
-            );
-            // Add column number every 5 columns
-            if (x % (24 * 5) == 0) {
-                char buf[32];
-                snprintf(buf, sizeof(buf), "c%d", x / 24);
-                draw_list->AddText(ImVec2(x + 2, 5), IM_COL32(255, 255, 255, 255), buf);
-            }
-        }
+    // Redraws the static layers before the next frame.
+    auto invalidate_layers() -> void {
+        m_layers_dirty = true;
+        request_redraw(1);
+    }
 
-        // Draw horizontal lines at cell boundaries (every 48 pixels)
-        for (int y = 0; y < m_height; y += 48) {
-            draw_list->AddLine(ImVec2(0, y), ImVec2(m_width, y),
-                               IM_COL32(255, 255, 255, 64) // dimmer lines
-            );
-            // Add row number
-            char buf[32];
-            snprintf(buf, sizeof(buf), "r%d", y / 48);
-            draw_list->AddText(ImVec2(5, y + 2), IM_COL32(255, 255, 255, 255), buf);
-        }
+    // Asks for at least `frames` more frames to be drawn, e.g. after input or when
+    // something on screen changes outside of ImGui.
+    auto request_redraw(int frames = REDRAW_FRAMES) -> void {
+        m_redraw_frames = std::max(m_redraw_frames, frames);
+    }
 
-        // Draw bright markers at the corners
-        const float marker_size = 48.0f; // Make markers one cell high
-        // Top-left
-        draw_list->AddLine(ImVec2(0, 0), ImVec2(marker_size, 0), IM_COL32(255, 0, 0, 255),
-                           3.0f);
-        draw_list->AddLine(ImVec2(0, 0), ImVec2(0, marker_size), IM_COL32(255, 0, 0, 255),
-                           3.0f);
-        draw_list->AddText(ImVec2(5, 5), IM_COL32(255, 0, 0, 255), "TL");
+    // True while a redraw was requested or ImGui has queued input it has not seen yet.
+    // Otherwise the last frame is still current and the loop can sleep.
+    [[nodiscard]] auto needs_redraw() const -> bool {
+        return m_redraw_frames > 0 || input_queued();
+    }
 
-        // Top-right
-        draw_list->AddLine(ImVec2(m_width, 0), ImVec2(m_width - marker_size, 0),
-                           IM_COL32(0, 255, 0, 255), 3.0f);
-        draw_list->AddLine(ImVec2(m_width, 0), ImVec2(m_width, marker_size),
-                           IM_COL32(0, 255, 0, 255), 3.0f);
-        draw_list->AddText(ImVec2(m_width - 24, 5), IM_COL32(0, 255, 0, 255), "TR");
+    // Readbacks that were issued but not mapped yet.
+    [[nodiscard]] auto readback_pending() const -> bool {
+        return m_pending > 0;
+    }
 
-        // Bottom-left
-        draw_list->AddLine(ImVec2(0, m_height), ImVec2(marker_size, m_height),
-                           IM_COL32(0, 0, 255, 255), 3.0f);
-        draw_list->AddLine(ImVec2(0, m_height), ImVec2(0, m_height - marker_size),
-                           IM_COL32(0, 0, 255, 255), 3.0f);
-        draw_list->AddText(ImVec2(5, m_height - 24), IM_COL32(0, 0, 255, 255), "BL");
+    // Whether the stats overlay is shown; its numbers change without any input, so it
+    // asks for a redraw every STATS_REFRESH_S.
+    [[nodiscard]] auto stats_visible() const -> bool {
+        return m_show_stats;
+    }
 
-        // Bottom-right
-        draw_list->AddLine(ImVec2(m_width, m_height),
-                           ImVec2(m_width - marker_size, m_height),
-                           IM_COL32(255, 255, 0, 255), 3.0f);
-        draw_list->AddLine(ImVec2(m_width, m_height),
-                           ImVec2(m_width, m_height - marker_size),
-                           IM_COL32(255, 255, 0, 255), 3.0f);
-        draw_list->AddText(ImVec2(m_width - 24, m_height - 24),
-                           IM_COL32(255, 255, 0, 255), "BR");
+    auto refresh_stats() -> void {
+        const std::chrono::duration<double> since =
+            std::chrono::steady_clock::now() - m_stats_drawn;
+        if (m_show_stats && since.count() >= STATS_REFRESH_S)
+            request_redraw(1);
+    }
+
+    auto frame() -> void {
+        StageTimer timer(Stage::Frame);
+        if (input_queued())
+            request_redraw();
+        m_redraw_frames = std::max(0, m_redraw_frames - 1);
+
+        if (!m_raster) {
+            glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+            ImGui_ImplOpenGL3_NewFrame();
+        }
+        m_context.new_frame();
+        // the hidden window keeps its initial size; the frame buffer is what counts
+        ImGuiIO &io = ImGui::GetIO();
+        io.DisplaySize = ImVec2(m_width, m_height);
+        io.DisplayFramebufferScale = ImVec2(1, 1);
+        ImGui::NewFrame();
+
+        // static layers need the current font, which NewFrame() sets up
+        if (m_layers_dirty || io.FontGlobalScale != m_layers_font_scale)
+            render_layers();
+
+        // Set next window to be fullscreen; its background is part of the grid layer
+        ImGui::SetNextWindowPos(ImVec2(0, 0));
+        ImGui::SetNextWindowSize(ImVec2(m_width, m_height));
+        ImGui::Begin("Demo", nullptr,
+                     ImGuiWindowFlags_NoDecoration | ImGuiWindowFlags_NoMove |
+                         ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoSavedSettings |
+                         ImGuiWindowFlags_NoBringToFrontOnFocus |
+                         ImGuiWindowFlags_NoBackground);
 
         // Display dimensions in cells
         char dim_buf[64];
         snprintf(dim_buf, sizeof(dim_buf), "Grid: %dx%d cells (%dx%d px)",
-                 m_width / GUI::CELL_WIDTH, m_height / GUI::CELL_HEIGHT, m_width,
-                 m_height);
+                 m_cols, m_rows, m_width, m_height);
         // Move text up from center to ensure visibility
         ImGui::SetCursorPos(ImVec2(m_width / 2 - 150, m_height / 3));
         ImGui::Text("%s", dim_buf);
 
         ImGui::End();
 
+        // F12 toggles the stage statistics, which are only collected from then on
+        if (ImGui::IsKeyPressed(ImGuiKey_F12, false)) {
+            m_show_stats = !m_show_stats;
+            pipeline_stats().enable();
+        }
+        if (m_show_stats) {
+            stats_overlay();
+            m_stats_drawn = std::chrono::steady_clock::now();
+        }
+
+        // a widget being dragged or edited (blinking text cursor) keeps animating
+        if (ImGui::IsAnyItemActive() || ImGui::GetIO().WantTextInput)
+            request_redraw(1);
+
         this->render();
     }
 
-    auto render() const -> void {
+    // Draws the ImGui frame over a copy of the static layers.
+    auto render() -> void {
         ImGui::Render();
 
-        glClearColor(CLEAR_COLOR.x * CLEAR_COLOR.w, CLEAR_COLOR.y * CLEAR_COLOR.w,
-                     CLEAR_COLOR.z * CLEAR_COLOR.w, CLEAR_COLOR.w);
+        if (m_raster) {
+            m_raster->render(ImGui::GetDrawData(), m_pixels.data(), m_width, m_height,
+                             clear_color(), m_background.data());
+            return;
+        }
 
-        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_layer_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+        glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
 
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
     }
 
-    [[nodiscard]] auto get_pixel_data() const -> std::vector<uint8_t> {
-        std::vector<uint8_t> data(m_width * m_height * 4);
+    // Queues a readback of the frame just rendered into the next pixel buffer and
+    // returns immediately; the GPU copies while we carry on with the next frame. A
+    // rasterized frame is already in memory, at most its alpha is dropped.
+    auto begin_readback() -> void {
+        if (m_raster) {
+            if (m_channels == 3)
+                pack_rgb(m_packed.data());
+            m_pending = 1;
+            return;
+        }
+        const int index = m_pbo_head;
+        assert(index != m_mapped && "unmap_readback() before starting the next readback");
 
-        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+        flip_on_gpu();
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[index]);
+        glReadPixels(0, 0, m_width, m_height, m_read_format, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        if (m_fences[index])
+            glDeleteSync(m_fences[index]);
+        m_fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        m_pbo_head = (index + 1) % PBO_COUNT;
+        // the ring overwrote the oldest readback if nobody consumed it
+        m_pending = std::min(m_pending + 1, PBO_COUNT - 1);
+    }
+
+    // Maps the oldest finished readback, leaving the newest `keep_in_flight` ones to the
+    // GPU. Returns an empty view if there is nothing old enough yet. The view stays valid
+    // until unmap_readback().
+    auto map_readback(int keep_in_flight = 1) -> PixelView {
+        if (m_raster) { // nothing is ever in flight
+            if (m_pending == 0)
+                return {};
+            m_pending = 0;
+            const uint8_t *data = m_channels == 3 ? m_packed.data() : m_pixels.data();
+            return {data, m_width, m_height, m_channels};
+        }
+        if (m_pending <= keep_in_flight)
+            return {};
+
+        const int index = (m_pbo_head - m_pending + PBO_COUNT) % PBO_COUNT;
+        StageTimer timer(Stage::Readback);
+        if (glClientWaitSync(m_fences[index], GL_SYNC_FLUSH_COMMANDS_BIT,
+                             FENCE_TIMEOUT_NS) == GL_WAIT_FAILED) {
+            std::cerr << "glClientWaitSync failed\n";
+        }
+        glDeleteSync(m_fences[index]);
+        m_fences[index] = nullptr;
+        m_pending--;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[index]);
+        void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                      static_cast<GLsizeiptr>(m_width) * m_height *
+                                          m_channels,
+                                      GL_MAP_READ_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!data) {
+            std::cerr << "glMapBufferRange failed\n";
+            return {};
+        }
+
+        m_mapped = index;
+        PixelView view = {static_cast<const uint8_t *>(data), m_width, m_height,
+                          m_channels};
+        timer.set_bytes_out(view.size());
+        return view;
+    }
+
+    auto unmap_readback() -> void {
+        if (m_mapped < 0)
+            return;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[m_mapped]);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        m_mapped = -1;
+    }
+
+    // Reads the frame top-down into `dst`, which must hold width * height * channels
+    // bytes (e.g. a pooled frame buffer or a shared memory segment).
+    auto get_pixel_data(uint8_t *dst) const -> void {
+        if (m_raster) {
+            if (m_channels == 3)
+                pack_rgb(dst);
+            else
+                std::memcpy(dst, m_pixels.data(), m_pixels.size());
+            return;
+        }
+        flip_on_gpu();
 
         // Check framebuffer status
-        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        GLenum status = glCheckFramebufferStatus(GL_READ_FRAMEBUFFER);
         if (status != GL_FRAMEBUFFER_COMPLETE) {
             std::cerr << "Framebuffer not complete when reading pixels! Status: "
                       << status << std::endl;
@@ -173,79 +427,340 @@ public:
 
         glReadBuffer(GL_COLOR_ATTACHMENT0);
         glPixelStorei(GL_PACK_ALIGNMENT, 1); // Ensure proper byte alignment
-        glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
-
-        // Check if we have any non-zero pixels
-        bool all_zero = true;
-        for (size_t i = 0; i < data.size() && i < 1000; ++i) {
-            if (data[i] != 0) {
-                all_zero = false;
-                break;
+        glReadPixels(0, 0, m_width, m_height, m_read_format, GL_UNSIGNED_BYTE, dst);
+    }
+
+private:
+    // Premultiplied like the frame buffer contents.
+    static auto clear_color() -> ImU32 {
+        return ImGui::ColorConvertFloat4ToU32(
+            ImVec4(CLEAR_COLOR.x * CLEAR_COLOR.w, CLEAR_COLOR.y * CLEAR_COLOR.w,
+                   CLEAR_COLOR.z * CLEAR_COLOR.w, CLEAR_COLOR.w));
+    }
+
+    // Renders all static layers over the clear color into the layer frame buffer, or
+    // the background pixels on the CPU path.
+    auto render_layers() -> void {
+        m_layers_dirty = false;
+        m_layers_font_scale = ImGui::GetIO().FontGlobalScale;
+
+        m_layer_list._ResetForNewFrame();
+        m_layer_list.PushClipRect(ImVec2(0, 0), ImVec2(m_width, m_height));
+        m_layer_list.PushTextureID(ImGui::GetIO().Fonts->TexID);
+        for (const auto &layer : m_layers)
+            layer(m_layer_list);
+        m_layer_list.PopTextureID();
+        m_layer_list.PopClipRect();
+
+        ImDrawData draw_data;
+        draw_data.Valid = true;
+        draw_data.DisplayPos = ImVec2(0, 0);
+        draw_data.DisplaySize = ImVec2(m_width, m_height);
+        draw_data.FramebufferScale = ImVec2(1, 1);
+        draw_data.AddDrawList(&m_layer_list);
+
+        if (m_raster) {
+            m_raster->render(&draw_data, m_background.data(), m_width, m_height,
+                             clear_color());
+            return;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, m_layer_fbo);
+        glClearColor(CLEAR_COLOR.x * CLEAR_COLOR.w, CLEAR_COLOR.y * CLEAR_COLOR.w,
+                     CLEAR_COLOR.z * CLEAR_COLOR.w, CLEAR_COLOR.w);
+        glClear(GL_COLOR_BUFFER_BIT);
+        ImGui_ImplOpenGL3_RenderDrawData(&draw_data);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    }
+
+    // The cell grid with its labels and corner markers, over the background of the
+    // full-screen window.
+    auto draw_grid(ImDrawList &draw_list) const -> void {
+        draw_list.AddRectFilled(ImVec2(0, 0), ImVec2(m_width, m_height),
+                                ImGui::GetColorU32(ImGuiCol_WindowBg));
+
+        // frame buffer pixels per cell, fractional when rendering below native size
+        const float cell_w = static_cast<float>(m_width) / m_cols;
+        const float cell_h = static_cast<float>(m_height) / m_rows;
+
+        // Draw vertical lines at cell boundaries
+        for (int col = 0; col < m_cols; col++) {
+            const float x = col * cell_w;
+            draw_list.AddLine(ImVec2(x, 0), ImVec2(x, m_height),
+                              IM_COL32(255, 255, 255, 64) // dimmer lines
+            );
+            // Add column number every 5 columns
+            if (col % 5 == 0) {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "c%d", col);
+                draw_list.AddText(ImVec2(x + 2, 5), IM_COL32(255, 255, 255, 255), buf);
             }
         }
 
-        // Flip pixels vertically
-        std::vector<uint8_t> flipped(m_width * m_height * 4);
-        for (int y = 0; y < m_height; y++) {
-            const int src_row = y;
-            const int dst_row = m_height - 1 - y;
-            std::memcpy(flipped.data() + dst_row * m_width * 4,
-                        data.data() + src_row * m_width * 4, m_width * 4);
+        // Draw horizontal lines at cell boundaries
+        for (int row = 0; row < m_rows; row++) {
+            const float y = row * cell_h;
+            draw_list.AddLine(ImVec2(0, y), ImVec2(m_width, y),
+                              IM_COL32(255, 255, 255, 64) // dimmer lines
+            );
+            // Add row number
+            char buf[32];
+            snprintf(buf, sizeof(buf), "r%d", row);
+            draw_list.AddText(ImVec2(5, y + 2), IM_COL32(255, 255, 255, 255), buf);
         }
 
-        return flipped;
+        // Draw bright markers at the corners
+        const float marker_size = cell_h; // Make markers one cell high
+        // Top-left
+        draw_list.AddLine(ImVec2(0, 0), ImVec2(marker_size, 0), IM_COL32(255, 0, 0, 255),
+                          3.0f);
+        draw_list.AddLine(ImVec2(0, 0), ImVec2(0, marker_size), IM_COL32(255, 0, 0, 255),
+                          3.0f);
+        draw_list.AddText(ImVec2(5, 5), IM_COL32(255, 0, 0, 255), "TL");
+
+        // Top-right
+        draw_list.AddLine(ImVec2(m_width, 0), ImVec2(m_width - marker_size, 0),
+                          IM_COL32(0, 255, 0, 255), 3.0f);
+        draw_list.AddLine(ImVec2(m_width, 0), ImVec2(m_width, marker_size),
+                          IM_COL32(0, 255, 0, 255), 3.0f);
+        draw_list.AddText(ImVec2(m_width - cell_w, 5), IM_COL32(0, 255, 0, 255), "TR");
+
+        // Bottom-left
+        draw_list.AddLine(ImVec2(0, m_height), ImVec2(marker_size, m_height),
+                          IM_COL32(0, 0, 255, 255), 3.0f);
+        draw_list.AddLine(ImVec2(0, m_height), ImVec2(0, m_height - marker_size),
+                          IM_COL32(0, 0, 255, 255), 3.0f);
+        draw_list.AddText(ImVec2(5, m_height - cell_h / 2), IM_COL32(0, 0, 255, 255),
+                          "BL");
+
+        // Bottom-right
+        draw_list.AddLine(ImVec2(m_width, m_height),
+                          ImVec2(m_width - marker_size, m_height),
+                          IM_COL32(255, 255, 0, 255), 3.0f);
+        draw_list.AddLine(ImVec2(m_width, m_height),
+                          ImVec2(m_width, m_height - marker_size),
+                          IM_COL32(255, 255, 0, 255), 3.0f);
+        draw_list.AddText(ImVec2(m_width - cell_w, m_height - cell_h / 2),
+                          IM_COL32(255, 255, 0, 255), "BR");
     }
 
-private:
-    GLuint m_fbo;
-    GLuint m_rbo;
-    int m_width;
-    int m_height;
+    // (Re)allocates the color buffer of `fbo` at the current size.
+    auto attach_storage(GLuint fbo, GLuint rbo) const -> void {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_width, m_height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                                  rbo);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Framebuffer is not complete!\n";
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    // The rasterized frame without its alpha channel.
+    auto pack_rgb(uint8_t *dst) const -> void {
+        const uint8_t *src = m_pixels.data();
+        for (size_t i = 0, n = static_cast<size_t>(m_width) * m_height; i < n; i++) {
+            dst[3 * i] = src[4 * i];
+            dst[3 * i + 1] = src[4 * i + 1];
+            dst[3 * i + 2] = src[4 * i + 2];
+        }
+    }
 
-    const ImVec4 CLEAR_COLOR = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
+    // Input events (from the GLFW callbacks or the tty) waiting for the next NewFrame().
+    static auto input_queued() -> bool {
+        return !ImGui::GetCurrentContext()->InputEventsQueue.empty();
+    }
+
+    // Blits the rendered frame upside down into the flip buffer and leaves that bound
+    // for reading.
+    auto flip_on_gpu() const -> void {
+        StageTimer timer(Stage::Flip);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_flip_fbo);
+        glBlitFramebuffer(0, 0, m_width, m_height, 0, m_height, m_width, 0,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_flip_fbo);
+    }
+
+    // Latency percentiles and byte counts of every stage since collection started.
+    static auto stats_overlay() -> void {
+        ImGui::SetNextWindowPos(ImVec2(20, 60), ImGuiCond_FirstUseEver);
+        ImGui::SetNextWindowBgAlpha(0.85f);
+        if (!ImGui::Begin("Pipeline stats (F12)", nullptr,
+                          ImGuiWindowFlags_AlwaysAutoResize |
+                              ImGuiWindowFlags_NoSavedSettings)) {
+            ImGui::End();
+            return;
+        }
+        ImGui::Text("Backend: %s", pipeline_stats().backend());
+        if (const uint64_t errors = pipeline_stats().errors())
+            ImGui::Text("Graphics errors: %llu, last: %s",
+                        static_cast<unsigned long long>(errors),
+                        pipeline_stats().last_error());
+        if (ImGui::BeginTable("stages", 7, ImGuiTableFlags_RowBg)) {
+            for (const char *header :
+                 {"stage", "count", "p50 us", "p99 us", "max us", "MB in", "MB out"})
+                ImGui::TableSetupColumn(header);
+            ImGui::TableHeadersRow();
+            for (size_t i = 0; i < PipelineStats::STAGES; i++) {
+                const auto stage = static_cast<Stage>(i);
+                const StageStats &stats = pipeline_stats().stage(stage);
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(stage_name(stage));
+                ImGui::TableNextColumn();
+                ImGui::Text("%llu",
+                            static_cast<unsigned long long>(stats.latency.count()));
+                for (double ns : {static_cast<double>(stats.latency.percentile(0.5)),
+                                  static_cast<double>(stats.latency.percentile(0.99)),
+                                  static_cast<double>(stats.latency.max())}) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.1f", ns / 1e3);
+                }
+                for (uint64_t bytes : {stats.bytes_in.load(std::memory_order_relaxed),
+                                       stats.bytes_out.load(std::memory_order_relaxed)}) {
+                    ImGui::TableNextColumn();
+                    ImGui::Text("%.1f", bytes / 1e6);
+                }
+            }
+            ImGui::EndTable();
+        }
+        ImGui::End();
+    }
+
+    GLuint m_fbo = 0;
+    GLuint m_rbo = 0;
+    GLuint m_flip_fbo = 0;
+    GLuint m_flip_rbo = 0;
+    GLuint m_layer_fbo = 0;
+    GLuint m_layer_rbo = 0;
+    int m_width = 0;
+    int m_height = 0;
+    int m_cols = 1;
+    int m_rows = 1;
+    OffscreenContext &m_context;
+    int m_channels;
+    GLenum m_read_format;
+
+    GLuint m_pbos[PBO_COUNT] = {};
+    GLsync m_fences[PBO_COUNT] = {};
+    int m_pbo_head = 0; // next buffer to read into
+    int m_pending = 0;  // readbacks issued but not mapped yet
+    int m_mapped = -1;  // buffer currently mapped, if any
+
+    // CPU rendering: the rasterizer, the font atlas it samples and the frame it draws
+    std::optional<SoftRasterizer> m_raster;
+    SoftTexture m_font;
+    std::vector<uint8_t> m_pixels; // RGBA, top-down
+    std::vector<uint8_t> m_packed; // m_pixels as RGB for the three channel formats
+    std::vector<uint8_t> m_background; // the static layers, RGBA
+
+    std::vector<std::function<void(ImDrawList &)>> m_layers;
+    ImDrawList m_layer_list; // reused by every render_layers()
+    bool m_layers_dirty = true;
+    float m_layers_font_scale = 0;
+
+    int m_redraw_frames = REDRAW_FRAMES;
+    bool m_show_stats = false;
+    std::chrono::steady_clock::time_point m_stats_drawn; // last overlay update
 };
 
-static void glfw_error_callback(int error, const char *description) {
-    fprintf(stderr, "GLFW Error %d: %s\n", error, description);
+// Terminal cells the GUI covers and the frame buffer rendered for them. The frame is
+// `scale` times the native pixel size of the cells; the terminal scales it back up.
+struct Layout {
+    int cols = 0;
+    int rows = 0;
+    int display_width = 0; // terminal pixels
+    int display_height = 0;
+    int width = 0; // frame buffer pixels
+    int height = 0;
+
+    auto operator==(const Layout &) const -> bool = default;
+};
+
+// KGP_RENDER_SCALE renders at a fraction (0.25 - 1) of the terminal's pixel size.
+static auto render_scale_from_env() -> double {
+    const char *env = std::getenv("KGP_RENDER_SCALE");
+    double scale = env ? std::atof(env) : 0;
+    return scale > 0 ? std::clamp(scale, 0.25, 1.0) : 1.0;
+}
+
+// Cell size from TIOCGWINSZ, else from the answer to CSI 14t/16t, else the defaults.
+static auto compute_layout(const TtyInput &tty_input, double scale) -> Layout {
+    TerminalSize term = terminal_size();
+    Layout layout;
+    layout.cols = term.cols > 0 ? term.cols : 80;
+    layout.rows = term.rows > 0 ? term.rows : 24;
+
+    auto [cell_w, cell_h] = tty_input.reported_cell_size(layout.cols, layout.rows);
+    if (term.width > 0 && term.height > 0) {
+        cell_w = term.width / layout.cols;
+        cell_h = term.height / layout.rows;
+    }
+    if (cell_w <= 0 || cell_h <= 0) {
+        cell_w = GUI::CELL_WIDTH;
+        cell_h = GUI::CELL_HEIGHT;
+    }
+
+    layout.display_width = layout.cols * cell_w;
+    layout.display_height = layout.rows * cell_h;
+    layout.width = std::max(1, static_cast<int>(layout.display_width * scale));
+    layout.height = std::max(1, static_cast<int>(layout.display_height * scale));
+    return layout;
 }
 
 // Main code
 int main(int, char **) {
     signal(SIGINT, catch_sigint);
-    glfwSetErrorCallback(glfw_error_callback);
-    if (!glfwInit())
-        return 1;
-
     setup_terminal();
 
-    // Decide GL+GLSL versions
-    // GL 3.2 + GLSL 150
+    // GL 3.2 + GLSL 150, from a hidden GLFW window or a surfaceless EGL context
     const char *glsl_version = "#version 150";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // 3.2+ only
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);           // Required on Mac
-
-    // Calculate dimensions from grid size
-    // Grid: 159 columns x 42 rows
-    // Cell size: 24x48 pixels
-    int width = 159 * GUI::CELL_WIDTH;  // 159 columns * 24px width
-    int height = 42 * GUI::CELL_HEIGHT; // 42 rows * 48px height
-
-    // Create window with graphics context
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    GLFWwindow *window =
-        glfwCreateWindow(width, height, "headless gui", nullptr, nullptr);
-    if (window == nullptr)
+
+    // The transport probe reads its answer from stdin, so it runs before TtyInput takes
+    // stdin over
+    const Transport transport = kitty_choose_transport();
+
+    // keyboard, mouse, size and graphics replies from the terminal; wakes
+    // OffscreenContext::wait_events()
+    TtyInput tty_input;
+    if (terminal_size().width == 0)
+        tty_input.request_size_report(); // answer arrives as a resize
+
+    // Frames go to one image whose ids outlive the pipelines built for each frame size;
+    // its replies are what the pacer counts as acks. The pacer lowers the render scale
+    // when the terminal cannot keep up.
+    KittyImage image;
+    FramePacer pacer(latency_budget_from_env(), zlib_level_from_env(), image.id());
+    // KGP_STATS=<path> times every stage from the start and writes them out on exit
+    const char *stats_path = stats_path_from_env();
+    const double render_scale = render_scale_from_env();
+    double scale = render_scale * pacer.scale();
+    Layout layout = compute_layout(tty_input, scale);
+    int width = layout.width;
+    int height = layout.height;
+
+    // KGP_RENDERER=cpu rasterizes on the CPU and needs no GL context at all
+    const Renderer renderer = renderer_from_env();
+
+    // context, ImGui backends and frame buffers, up to the first frame
+    std::optional<StageTimer> startup_timer(std::in_place, Stage::Startup);
+    OffscreenContext context(
+        renderer == Renderer::Soft ? GLBackend::None : gl_backend_from_env(), width,
+        height);
+    if (!context) {
+        restore_terminal();
         return 1;
-    glfwMakeContextCurrent(window);
-    glfwSwapInterval(1); // Enable vsync
+    }
+    pipeline_stats().set_backend(renderer == Renderer::Soft
+                                     ? renderer_name(renderer)
+                                     : gl_backend_name(context.backend()));
 
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
     ImGuiIO &io = ImGui::GetIO();
-    (void)io;
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard; // Enable Keyboard Controls
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;  // Enable Gamepad Controls
 
@@ -254,53 +769,130 @@ int main(int, char **) {
     // ImGui::StyleColorsLight();
 
     // Setup Platform/Renderer backends
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init(glsl_version);
+    context.init_imgui();
+    if (renderer == Renderer::OpenGL)
+        ImGui_ImplOpenGL3_Init(glsl_version);
+
+    const PixelFormat format = pixel_format_from_env();
+    GUI gui(context, width, height, layout.cols, layout.rows, format, renderer);
+    startup_timer.reset();
+
+    // the palette format snaps frames to the colors of the current style
+    std::optional<PaletteQuantizer> quantizer;
+    if (format == PixelFormat::Palette) {
+        std::vector<std::array<float, 4>> style_colors;
+        for (const ImVec4 &c : ImGui::GetStyle().Colors)
+            style_colors.push_back({c.x, c.y, c.z, c.w});
+        quantizer = PaletteQuantizer::from_style(
+            style_colors, {GUI::CLEAR_COLOR.x, GUI::CLEAR_COLOR.y, GUI::CLEAR_COLOR.z});
+    }
 
-    GUI gui(width, height);
+    // Compression, encoding and tty writes run on the pipeline's threads; this thread
+    // only renders and reads back. Rebuilt for every new frame size, while the image
+    // keeps its ids on the terminal.
+    // KGP_DELTA picks how changed rectangles are encoded after the first upload
+    const DeltaMode delta = delta_mode_from_env();
+    std::optional<FramePipeline> pipeline;
+    pipeline.emplace(width, height, layout.cols, layout.rows, transport, format, delta,
+                     image, pacer, quantizer ? &*quantizer : nullptr);
+
+    auto apply_layout = [&] {
+        // terminal coordinates to frame buffer pixels
+        const float scale_x = static_cast<float>(layout.width) / layout.display_width;
+        const float scale_y = static_cast<float>(layout.height) / layout.display_height;
+        tty_input.set_mapping(static_cast<float>(layout.width) / layout.cols,
+                              static_cast<float>(layout.height) / layout.rows, scale_x,
+                              scale_y);
+        // keep the UI the same size on screen whatever the render scale
+        io.FontGlobalScale = static_cast<float>(scale);
+    };
+    apply_layout();
+
+#ifdef KGP_COUNT_ALLOCATIONS
+    // buffers grow to their working size during the first frames, none after that
+    constexpr int WARMUP_FRAMES = 120;
+    int frame_count = 0;
+    uint64_t steady_allocations = 0;
+#endif
 
     // Main loop
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
-
-        gui.frame();
-
-        std::vector<uint8_t> pixels = gui.get_pixel_data();
-
-        // Scale down dimensions for terminal display
-        // Try using half the size first
-        int display_width = width / 2;
-        int display_height = height / 2;
+    while (!context.should_close() && !pipeline->failed()) {
+        context.poll_events();
+        tty_input.drain(io, [&](const KittyReply &reply) {
+            pipeline->on_reply(reply);
+            pacer.on_reply(reply);
+        });
+        if (tty_input.quit_requested())
+            break;
 
-        // Compress the pixel data using zlib
-        uLongf compressed_size = compressBound(pixels.size());
-        std::vector<uint8_t> compressed_data(compressed_size);
+        // SIGWINCH, a late size report or the pacer changing the render scale: rebuild
+        // the frame buffers and the pipeline at the new size
+        const bool resized = tty_input.take_resized();
+        if (resized || scale != render_scale * pacer.scale()) {
+            scale = render_scale * pacer.scale();
+            Layout next = compute_layout(tty_input, scale);
+            if (!(next == layout)) {
+                layout = next;
+                pipeline.reset(); // drains the frames it still holds
+                gui.resize(layout.width, layout.height, layout.cols, layout.rows);
+                pipeline.emplace(layout.width, layout.height, layout.cols, layout.rows,
+                                 transport, format, delta, image, pacer,
+                                 quantizer ? &*quantizer : nullptr);
+#ifdef KGP_COUNT_ALLOCATIONS
+                frame_count = 0; // the new buffers warm up again
+#endif
+            }
+            apply_layout();
+            gui.request_redraw();
+        }
 
-        if (compress2(compressed_data.data(), &compressed_size, pixels.data(),
-                      pixels.size(), Z_BEST_COMPRESSION) != Z_OK) {
-            std::cerr << "Failed to compress pixel data" << std::endl;
-            break;
+        // Frames are only drawn on input or an explicit request_redraw(); an idle UI
+        // costs nothing but the wait below
+        gui.refresh_stats();
+        const bool draw = gui.needs_redraw();
+        if (draw) {
+            gui.frame();
+            gui.begin_readback();
         }
-        compressed_data.resize(compressed_size);
-        std::cout << "width: " << width << ", height: " << height << std::endl;
 
-        // Format: a=T (transmit+display), o=z (zlib compression), f=32 (RGBA), s=width, v=height
-        std::string cmd =
-            "a=T,o=z,f=32,s=" + std::to_string(width) + ",v=" + std::to_string(height);
-        kitty_send_command(cmd, compressed_data.data(), compressed_data.size());
+        // The readback of this frame overlaps the next one; what we send now is the
+        // previous frame, which the GPU has finished by now. Without a new frame to
+        // overlap with, the ring is drained so the last one is not left behind. Only one
+        // frame is in flight: until the terminal acknowledges it, newer frames stay in
+        // the ring (which keeps the newest) instead of being sent.
+        if (gui.readback_pending() && pacer.ready()) {
+            GUI::PixelView view = gui.map_readback(draw ? 1 : 0);
+            if (view) {
+                pipeline->submit(view.data);
+                gui.unmap_readback();
+            }
+        }
 
-        // Move cursor back to top-left after each frame
-        std::cout << "\x1B[H" << std::flush;
+#ifdef KGP_COUNT_ALLOCATIONS
+        if (++frame_count == WARMUP_FRAMES)
+            steady_allocations = heap_allocations();
+        assert(frame_count < WARMUP_FRAMES || heap_allocations() == steady_allocations);
+#endif
 
-        // Small sleep to prevent overwhelming the terminal
-        glfwWaitEventsTimeout(0.016); // roughly 60 FPS
+        // the pacer lowers the frame rate when the terminal falls behind; with nothing
+        // to draw or send, sleep until the window system or the tty has an event
+        if (gui.needs_redraw() || gui.readback_pending())
+            context.wait_events(pacer.frame_interval());
+        else if (gui.stats_visible())
+            context.wait_events(GUI::STATS_REFRESH_S);
+        else
+            context.wait_events();
     }
 
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui_ImplGlfw_Shutdown();
+    pipeline.reset();
+    image.remove();
+    if (stats_path)
+        pipeline_stats().dump(stats_path);
+
+    if (renderer == Renderer::OpenGL)
+        ImGui_ImplOpenGL3_Shutdown();
+    context.shutdown_imgui();
     ImGui::DestroyContext();
-    glfwDestroyWindow(window);
-    glfwTerminate();
 
     restore_terminal();
 
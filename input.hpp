@@ -0,0 +1,751 @@
+#pragma once
+
+#include "context.hpp"
+#include "imgui.h"
+#include "kgp.hpp"
+#include "spsc.hpp"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include <utility>
+#include <unistd.h>
+
+/*
+ * Terminal input bridge. The offscreen GL context never sees a key or the mouse, so a
+ * reader thread takes stdin instead: kitty keyboard protocol reports, SGR mouse reports
+ * (in pixels where the terminal supports mode 1016), focus changes and graphics replies.
+ * It parses them straight out of its read buffer with a table driven state machine and
+ * hands fixed size events to the render loop through SPSC queues, then wakes the loop
+ * sleeping in OffscreenContext::wait_events(). The loop feeds the events to ImGuiIO in
+ * drain(); ImGui itself is only touched from that thread.
+ *
+ * Mouse motion is coalesced per read: only the last position before another event (or
+ * the end of the batch) is queued, so a fast mouse cannot build up a backlog.
+ *
+ * The same thread notices SIGWINCH (through a self-pipe) and the answers to the CSI 14t /
+ * 16t size queries, for terminals that leave the pixel fields of TIOCGWINSZ empty.
+ */
+
+struct InputEvent {
+    enum class Type : uint8_t {
+        Key,
+        Text,
+        MouseMove,
+        MouseButton,
+        MouseWheel,
+        Focus,
+        CellSize,     // CSI 16t answer, x/y in pixels
+        TextAreaSize, // CSI 14t answer, x/y in pixels
+    };
+
+    Type type;
+    bool down = false;   // key or button pressed, focus gained
+    bool pixels = false; // x/y are terminal pixels (mode 1016) rather than 1-based cells
+    uint8_t mods = 0;    // kitty modifier bits: 1 shift, 2 alt, 4 ctrl, 8 super
+    int button = 0;      // ImGui mouse button
+    ImGuiKey key = ImGuiKey_None;
+    uint32_t codepoint = 0;
+    float x = 0, y = 0; // mouse position, wheel delta, reported size
+};
+
+/*
+ * Byte-at-a-time escape sequence parser. Every byte is classified, then a
+ * [state][class] table gives the action to run and the next state. CSI parameters are
+ * accumulated as integers in place, so nothing is copied except graphics reply bodies.
+ */
+class TtyParser {
+public:
+    static constexpr uint8_t MOD_SHIFT = 1, MOD_ALT = 2, MOD_CTRL = 4, MOD_SUPER = 8;
+
+    // Calls on_event(const InputEvent &) and on_reply(const KittyReply &) for everything
+    // complete in `data`; partial sequences are carried over to the next call.
+    template <typename OnEvent, typename OnReply>
+    auto feed(const char *data, size_t size, OnEvent &&on_event, OnReply &&on_reply)
+        -> void {
+        for (size_t i = 0; i < size; i++) {
+            const auto byte = static_cast<uint8_t>(data[i]);
+            const Transition t = TABLE[static_cast<int>(m_state)][CLASSES[byte]];
+            m_state = t.next;
+            switch (t.action) {
+            case Action::None: break;
+            case Action::Text: text_byte(byte, on_event); break;
+            case Action::Control: control_byte(byte, on_event); break;
+            case Action::Clear: clear(); break;
+            case Action::Digit: digit(byte); break;
+            case Action::Separator: separator(false); break;
+            case Action::SubSeparator: separator(true); break;
+            case Action::Private: m_private = static_cast<char>(byte); break;
+            case Action::Intermediate: m_intermediate = static_cast<char>(byte); break;
+            case Action::CsiDispatch: csi_dispatch(byte, on_event); break;
+            case Action::Ss3Dispatch: ss3_dispatch(byte, on_event); break;
+            case Action::ApcStart: m_body_len = 0; break;
+            case Action::ApcByte:
+                if (m_body_len < sizeof(m_body))
+                    m_body[m_body_len++] = static_cast<char>(byte);
+                break;
+            case Action::ApcEnd: apc_end(on_reply); break;
+            }
+        }
+    }
+
+    // Set once the terminal confirmed SGR pixel mouse reports (DECRPM for mode 1016).
+    [[nodiscard]] auto pixel_mouse() const -> bool {
+        return m_pixel_mouse;
+    }
+
+    // Ctrl+C arrives as a key report under the kitty protocol, not as SIGINT.
+    [[nodiscard]] auto quit_requested() const -> bool {
+        return m_quit;
+    }
+
+private:
+    enum class State : uint8_t { Ground, Esc, Csi, Ss3, Apc, ApcEsc, Count };
+    enum class Action : uint8_t {
+        None,
+        Text,
+        Control,
+        Clear,
+        Digit,
+        Separator,
+        SubSeparator,
+        Private,
+        Intermediate,
+        CsiDispatch,
+        Ss3Dispatch,
+        ApcStart,
+        ApcByte,
+        ApcEnd,
+    };
+    enum Class : uint8_t {
+        C_TEXT,   // printable ASCII and UTF-8 bytes
+        C_CTRL,   // C0 controls and DEL
+        C_ESC,    // 0x1B
+        C_DIGIT,  // 0-9
+        C_SEMI,   // ;
+        C_COLON,  // :
+        C_PRIV,   // < = > ?
+        C_INTER,  // 0x20-0x2F
+        C_FINAL,  // 0x40-0x7E not listed below
+        C_CSI,    // [
+        C_SS3,    // O
+        C_APC,    // _
+        C_ST,     // backslash
+        C_COUNT,
+    };
+
+    struct Transition {
+        State next = State::Ground;
+        Action action = Action::None;
+    };
+    static constexpr int STATE_COUNT = static_cast<int>(State::Count);
+    using Table = std::array<std::array<Transition, C_COUNT>, STATE_COUNT>;
+
+    static constexpr auto make_classes() -> std::array<uint8_t, 256> {
+        std::array<uint8_t, 256> classes{};
+        for (int c = 0; c < 256; c++) {
+            uint8_t cls = C_TEXT;
+            if (c < 0x20 || c == 0x7F)
+                cls = C_CTRL;
+            else if (c >= 0x20 && c <= 0x2F)
+                cls = C_INTER;
+            else if (c >= '0' && c <= '9')
+                cls = C_DIGIT;
+            else if (c >= 0x40 && c <= 0x7E)
+                cls = C_FINAL;
+            classes[c] = cls;
+        }
+        classes[0x1B] = C_ESC;
+        classes[';'] = C_SEMI;
+        classes[':'] = C_COLON;
+        for (char c : {'<', '=', '>', '?'})
+            classes[static_cast<uint8_t>(c)] = C_PRIV;
+        classes['['] = C_CSI;
+        classes['O'] = C_SS3;
+        classes['_'] = C_APC;
+        classes['\\'] = C_ST;
+        return classes;
+    }
+
+    static constexpr auto make_table() -> Table {
+        Table t{};
+        auto row = [&](State s) -> auto & { return t[static_cast<int>(s)]; };
+        using enum State;
+        using A = Action;
+
+        for (auto &cell : row(Ground))
+            cell = {Ground, A::Text};
+        row(Ground)[C_CTRL] = {Ground, A::Control};
+        row(Ground)[C_ESC] = {Esc, A::None};
+
+        // ESC + anything unknown: drop it (alt+key in legacy encoding)
+        for (auto &cell : row(Esc))
+            cell = {Ground, A::None};
+        row(Esc)[C_ESC] = {Esc, A::None};
+        row(Esc)[C_CSI] = {Csi, A::Clear};
+        row(Esc)[C_SS3] = {Ss3, A::Clear};
+        row(Esc)[C_APC] = {Apc, A::ApcStart};
+
+        for (auto &cell : row(Csi))
+            cell = {Csi, A::None};
+        row(Csi)[C_ESC] = {Esc, A::None}; // broken sequence, start over
+        row(Csi)[C_DIGIT] = {Csi, A::Digit};
+        row(Csi)[C_SEMI] = {Csi, A::Separator};
+        row(Csi)[C_COLON] = {Csi, A::SubSeparator};
+        row(Csi)[C_PRIV] = {Csi, A::Private};
+        row(Csi)[C_INTER] = {Csi, A::Intermediate};
+        for (auto cls : {C_FINAL, C_CSI, C_SS3, C_APC, C_ST})
+            row(Csi)[cls] = {Ground, A::CsiDispatch};
+        row(Csi)[C_TEXT] = {Ground, A::None}; // not a CSI byte, drop the sequence
+
+        for (auto &cell : row(Ss3))
+            cell = {Ground, A::Ss3Dispatch};
+        row(Ss3)[C_ESC] = {Esc, A::None};
+
+        for (auto &cell : row(Apc))
+            cell = {Apc, A::ApcByte};
+        row(Apc)[C_ESC] = {ApcEsc, A::None};
+
+        for (auto &cell : row(ApcEsc))
+            cell = {Ground, A::None};
+        row(ApcEsc)[C_ST] = {Ground, A::ApcEnd};
+        return t;
+    }
+
+    static const std::array<uint8_t, 256> CLASSES;
+    static const Table TABLE;
+
+    static constexpr int MAX_FIELDS = 8;
+    static constexpr int MAX_VALUES = 24;
+
+    auto clear() -> void {
+        m_private = 0;
+        m_intermediate = 0;
+        m_value_count = 1;
+        m_values[0] = 0;
+        m_field_count = 1;
+        m_field_start[0] = 0;
+    }
+
+    auto digit(uint8_t byte) -> void {
+        int &value = m_values[m_value_count - 1];
+        if (value < 1'000'000)
+            value = value * 10 + (byte - '0');
+    }
+
+    // `;` starts a new field, `:` a new sub-parameter of the current one.
+    auto separator(bool sub) -> void {
+        if (m_value_count == MAX_VALUES || (!sub && m_field_count == MAX_FIELDS))
+            return;
+        if (!sub)
+            m_field_start[m_field_count++] = m_value_count;
+        m_values[m_value_count++] = 0;
+    }
+
+    [[nodiscard]] auto field_end(int field) const -> int {
+        return field + 1 < m_field_count ? m_field_start[field + 1] : m_value_count;
+    }
+
+    // Sub-parameter `sub` of field `field`, `fallback` when missing or empty.
+    [[nodiscard]] auto param(int field, int sub = 0, int fallback = 0) const -> int {
+        if (field >= m_field_count)
+            return fallback;
+        const int start = m_field_start[field];
+        const int end = field_end(field);
+        if (start + sub >= end)
+            return fallback;
+        const int value = m_values[start + sub];
+        return value == 0 ? fallback : value;
+    }
+
+    [[nodiscard]] auto field_size(int field) const -> int {
+        if (field >= m_field_count)
+            return 0;
+        const int end = field_end(field);
+        return end - m_field_start[field];
+    }
+
+    template <typename OnEvent>
+    auto emit_key(ImGuiKey key, uint8_t mods, int event_type, OnEvent &on_event) -> void {
+        if (key == ImGuiKey_None)
+            return;
+        if (key == ImGuiKey_C && (mods & MOD_CTRL) && event_type != 3)
+            m_quit = true;
+        InputEvent event{InputEvent::Type::Key};
+        event.key = key;
+        event.mods = mods;
+        // legacy encodings have no release events: press and release right away
+        event.down = event_type != 3;
+        on_event(event);
+        if (event_type == 0) {
+            event.down = false;
+            on_event(event);
+        }
+    }
+
+    template <typename OnEvent>
+    auto emit_text(uint32_t codepoint, OnEvent &on_event) -> void {
+        InputEvent event{InputEvent::Type::Text};
+        event.codepoint = codepoint;
+        on_event(event);
+    }
+
+    // Plain bytes only show up from terminals without the kitty keyboard protocol.
+    template <typename OnEvent>
+    auto text_byte(uint8_t byte, OnEvent &on_event) -> void {
+        if (byte < 0x80) {
+            m_utf8_left = 0;
+            emit_text(byte, on_event);
+        } else if (byte >= 0xC0) {
+            m_utf8_left = byte >= 0xF0 ? 3 : byte >= 0xE0 ? 2 : 1;
+            m_codepoint = byte & (0x3F >> m_utf8_left);
+        } else if (m_utf8_left > 0) {
+            m_codepoint = (m_codepoint << 6) | (byte & 0x3F);
+            if (--m_utf8_left == 0)
+                emit_text(m_codepoint, on_event);
+        }
+    }
+
+    template <typename OnEvent>
+    auto control_byte(uint8_t byte, OnEvent &on_event) -> void {
+        switch (byte) {
+        case '\r': emit_key(ImGuiKey_Enter, 0, 0, on_event); break;
+        case '\t': emit_key(ImGuiKey_Tab, 0, 0, on_event); break;
+        case 0x7F:
+        case 0x08: emit_key(ImGuiKey_Backspace, 0, 0, on_event); break;
+        default: break;
+        }
+    }
+
+    // Kitty modifiers are sent as 1 + bits.
+    [[nodiscard]] auto modifiers(int field) const -> uint8_t {
+        return static_cast<uint8_t>(std::max(0, param(field, 0, 1) - 1));
+    }
+
+    template <typename OnEvent>
+    auto csi_dispatch(uint8_t byte, OnEvent &on_event) -> void {
+        const char final = static_cast<char>(byte);
+        if (m_private == '<' && (final == 'M' || final == 'm')) {
+            mouse(final == 'M', on_event);
+        } else if (m_private == '?' && m_intermediate == '$' && final == 'y') {
+            // DECRPM: mode 1016 set (1) or permanently set (3)
+            if (param(0) == 1016)
+                m_pixel_mouse = param(1) == 1 || param(1) == 3;
+        } else if (m_private == 0 && final == 'u') {
+            kitty_key(on_event);
+        } else if (m_private == 0 && final == '~') {
+            emit_key(tilde_key(param(0)), modifiers(1), param(1, 1, 0), on_event);
+        } else if (m_private == 0 && final == 't' && (param(0) == 4 || param(0) == 6)) {
+            // CSI 4 ; height ; width t (text area) or CSI 6 ; height ; width t (cell)
+            InputEvent event{param(0) == 4 ? InputEvent::Type::TextAreaSize
+                                           : InputEvent::Type::CellSize};
+            event.x = static_cast<float>(param(2));
+            event.y = static_cast<float>(param(1));
+            on_event(event);
+        } else if (m_private == 0 && (final == 'I' || final == 'O') && param(0) == 0) {
+            InputEvent event{InputEvent::Type::Focus};
+            event.down = final == 'I';
+            on_event(event);
+        } else if (m_private == 0) {
+            emit_key(letter_key(final), modifiers(1), param(1, 1, 0), on_event);
+        }
+    }
+
+    template <typename OnEvent>
+    auto ss3_dispatch(uint8_t byte, OnEvent &on_event) -> void {
+        emit_key(letter_key(static_cast<char>(byte)), 0, 0, on_event);
+    }
+
+    // CSI code[:alternates] ; modifiers[:event] ; text-codepoints u
+    template <typename OnEvent>
+    auto kitty_key(OnEvent &on_event) -> void {
+        const int code = param(0);
+        const uint8_t mods = modifiers(1);
+        const int event_type = param(1, 1, 1); // 1 press, 2 repeat, 3 release
+        emit_key(kitty_code_key(code), mods, event_type, on_event);
+
+        if (event_type == 3)
+            return;
+        if (field_size(2) > 0) {
+            for (int i = 0; i < field_size(2); i++)
+                emit_text(static_cast<uint32_t>(param(2, i)), on_event);
+        } else if (code >= 0x20 && code != 0x7F && code < 0xE000 &&
+                   !(mods & (MOD_CTRL | MOD_ALT | MOD_SUPER))) {
+            // no associated text reported: the key code is the unshifted character
+            emit_text(static_cast<uint32_t>(code), on_event);
+        }
+    }
+
+    // CSI < button ; x ; y M (press, motion) or m (release)
+    template <typename OnEvent>
+    auto mouse(bool press, OnEvent &on_event) -> void {
+        const int code = m_values[0];
+        InputEvent event{InputEvent::Type::MouseMove};
+        event.pixels = m_pixel_mouse;
+        event.x = static_cast<float>(param(1));
+        event.y = static_cast<float>(param(2));
+        on_event(event);
+
+        if (code & 32)
+            return; // motion only
+        if (code & 64) {
+            InputEvent wheel{InputEvent::Type::MouseWheel};
+            const int dir = code & 3;
+            wheel.x = dir == 2 ? 1.0f : dir == 3 ? -1.0f : 0.0f;
+            wheel.y = dir == 0 ? 1.0f : dir == 1 ? -1.0f : 0.0f;
+            on_event(wheel);
+            return;
+        }
+        static constexpr int BUTTONS[] = {0, 2, 1}; // left, middle, right in ImGui order
+        if ((code & 3) == 3)
+            return;
+        InputEvent button{InputEvent::Type::MouseButton};
+        button.button = BUTTONS[code & 3];
+        button.down = press;
+        on_event(button);
+    }
+
+    template <typename OnReply>
+    auto apc_end(OnReply &on_reply) -> void {
+        KittyReply reply;
+        if (m_body_len > 0 && m_body[0] == 'G' &&
+            kitty_parse_reply({m_body + 1, m_body_len - 1}, reply))
+            on_reply(reply);
+    }
+
+    static auto letter_key(char final) -> ImGuiKey {
+        switch (final) {
+        case 'A': return ImGuiKey_UpArrow;
+        case 'B': return ImGuiKey_DownArrow;
+        case 'C': return ImGuiKey_RightArrow;
+        case 'D': return ImGuiKey_LeftArrow;
+        case 'H': return ImGuiKey_Home;
+        case 'F': return ImGuiKey_End;
+        case 'P': return ImGuiKey_F1;
+        case 'Q': return ImGuiKey_F2;
+        case 'R': return ImGuiKey_F3;
+        case 'S': return ImGuiKey_F4;
+        default: return ImGuiKey_None;
+        }
+    }
+
+    static auto tilde_key(int number) -> ImGuiKey {
+        switch (number) {
+        case 2: return ImGuiKey_Insert;
+        case 3: return ImGuiKey_Delete;
+        case 5: return ImGuiKey_PageUp;
+        case 6: return ImGuiKey_PageDown;
+        case 7: return ImGuiKey_Home;
+        case 8: return ImGuiKey_End;
+        case 13: return ImGuiKey_F3;
+        case 15: return ImGuiKey_F5;
+        case 17: return ImGuiKey_F6;
+        case 18: return ImGuiKey_F7;
+        case 19: return ImGuiKey_F8;
+        case 20: return ImGuiKey_F9;
+        case 21: return ImGuiKey_F10;
+        case 23: return ImGuiKey_F11;
+        case 24: return ImGuiKey_F12;
+        default: return ImGuiKey_None;
+        }
+    }
+
+    static auto kitty_code_key(int code) -> ImGuiKey {
+        if (code >= 'a' && code <= 'z')
+            return static_cast<ImGuiKey>(ImGuiKey_A + (code - 'a'));
+        if (code >= '0' && code <= '9')
+            return static_cast<ImGuiKey>(ImGuiKey_0 + (code - '0'));
+        switch (code) {
+        case 9: return ImGuiKey_Tab;
+        case 13: return ImGuiKey_Enter;
+        case 27: return ImGuiKey_Escape;
+        case 32: return ImGuiKey_Space;
+        case 127: return ImGuiKey_Backspace;
+        case '\'': return ImGuiKey_Apostrophe;
+        case ',': return ImGuiKey_Comma;
+        case '-': return ImGuiKey_Minus;
+        case '.': return ImGuiKey_Period;
+        case '/': return ImGuiKey_Slash;
+        case ';': return ImGuiKey_Semicolon;
+        case '=': return ImGuiKey_Equal;
+        case '[': return ImGuiKey_LeftBracket;
+        case '\\': return ImGuiKey_Backslash;
+        case ']': return ImGuiKey_RightBracket;
+        case '`': return ImGuiKey_GraveAccent;
+        // functional keys from the kitty private use area
+        case 57441: return ImGuiKey_LeftShift;
+        case 57442: return ImGuiKey_LeftCtrl;
+        case 57443: return ImGuiKey_LeftAlt;
+        case 57444: return ImGuiKey_LeftSuper;
+        case 57447: return ImGuiKey_RightShift;
+        case 57448: return ImGuiKey_RightCtrl;
+        case 57449: return ImGuiKey_RightAlt;
+        case 57450: return ImGuiKey_RightSuper;
+        case 57414: return ImGuiKey_KeypadEnter;
+        default: return ImGuiKey_None;
+        }
+    }
+
+    State m_state = State::Ground;
+    char m_private = 0;
+    char m_intermediate = 0;
+    int m_values[MAX_VALUES] = {};
+    int m_value_count = 1;
+    int m_field_start[MAX_FIELDS] = {};
+    int m_field_count = 1;
+
+    char m_body[256];
+    size_t m_body_len = 0;
+
+    uint32_t m_codepoint = 0;
+    int m_utf8_left = 0;
+
+    bool m_pixel_mouse = false;
+    bool m_quit = false;
+};
+
+inline constexpr std::array<uint8_t, 256> TtyParser::CLASSES = TtyParser::make_classes();
+inline constexpr TtyParser::Table TtyParser::TABLE = TtyParser::make_table();
+
+class TtyInput {
+public:
+    static constexpr size_t QUEUE_SIZE = 512;
+
+    TtyInput() {
+        // kitty keyboard flags 1|2|8|16: disambiguate, report press/repeat/release,
+        // every key as an escape code, with its text. Any-motion mouse tracking in SGR
+        // encoding, pixel coordinates (1016), focus reports. The DECRQM query tells us
+        // whether 1016 took. restore_terminal() switches all of it off again.
+        KittyWriter &writer = kitty_writer();
+        writer.write_control(CSI ">27u" CSI "?1003h" CSI "?1006h" CSI "?1016h" CSI
+                             "?1004h" CSI "?1016$p");
+        writer.flush();
+
+        if (pipe(m_stop_pipe) != 0) {
+            m_stop_pipe[0] = m_stop_pipe[1] = -1;
+            return;
+        }
+        if (pipe(m_winch_pipe) == 0) {
+            fcntl(m_winch_pipe[1], F_SETFL, O_NONBLOCK);
+            s_winch_fd = m_winch_pipe[1];
+            struct sigaction sa = {};
+            sa.sa_handler = [](int) {
+                int saved = errno;
+                (void)!write(s_winch_fd, "", 1);
+                errno = saved;
+            };
+            sa.sa_flags = SA_RESTART;
+            sigemptyset(&sa.sa_mask);
+            sigaction(SIGWINCH, &sa, nullptr);
+        }
+        m_thread = std::thread([this] { run(); });
+    }
+
+    TtyInput(const TtyInput &) = delete;
+    TtyInput &operator=(const TtyInput &) = delete;
+
+    ~TtyInput() {
+        if (!m_thread.joinable())
+            return;
+        (void)!write(m_stop_pipe[1], "", 1);
+        m_thread.join();
+        close(m_stop_pipe[0]);
+        close(m_stop_pipe[1]);
+        if (m_winch_pipe[0] >= 0) {
+            signal(SIGWINCH, SIG_DFL);
+            s_winch_fd = -1;
+            close(m_winch_pipe[0]);
+            close(m_winch_pipe[1]);
+        }
+    }
+
+    // How terminal coordinates map onto the framebuffer: `cell_width`/`cell_height`
+    // framebuffer pixels per cell for cell reports, `scale_x`/`scale_y` framebuffer
+    // pixels per terminal pixel for pixel reports (below 1 when placed upscaled).
+    auto set_mapping(float cell_width, float cell_height, float scale_x, float scale_y)
+        -> void {
+        m_cell_width = cell_width;
+        m_cell_height = cell_height;
+        m_scale_x = scale_x;
+        m_scale_y = scale_y;
+    }
+
+    // Asks the terminal for its text area and cell size in pixels (CSI 14t, CSI 16t).
+    // The answers show up in reported_cell_size().
+    auto request_size_report() -> void {
+        kitty_writer().write_control(CSI "14t" CSI "16t");
+        kitty_writer().flush();
+    }
+
+    // Cell size in pixels from the last size report, {0, 0} if none arrived yet. Derived
+    // from the text area when only CSI 14t is answered.
+    [[nodiscard]] auto reported_cell_size(int cols, int rows) const
+        -> std::pair<int, int> {
+        int w = m_cell_px_width.load(std::memory_order_relaxed);
+        int h = m_cell_px_height.load(std::memory_order_relaxed);
+        if ((w == 0 || h == 0) && cols > 0 && rows > 0) {
+            w = m_area_px_width.load(std::memory_order_relaxed) / cols;
+            h = m_area_px_height.load(std::memory_order_relaxed) / rows;
+        }
+        return {w, h};
+    }
+
+    // True once after each SIGWINCH.
+    auto take_resized() -> bool {
+        return m_resized.exchange(false, std::memory_order_relaxed);
+    }
+
+    // Feeds queued input to ImGui and hands graphics replies to `on_reply`. Render loop
+    // thread only.
+    template <typename OnReply>
+    auto drain(ImGuiIO &io, OnReply &&on_reply) -> void {
+        KittyReply reply;
+        while (m_replies.try_pop(reply))
+            on_reply(reply);
+
+        InputEvent event{};
+        while (m_events.try_pop(event))
+            apply(io, event);
+    }
+
+    [[nodiscard]] auto quit_requested() const -> bool {
+        return m_quit.load(std::memory_order_relaxed);
+    }
+
+private:
+    auto run() -> void {
+        char buf[4096];
+        for (;;) {
+            pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0},
+                             {m_stop_pipe[0], POLLIN, 0},
+                             {m_winch_pipe[0], POLLIN, 0}};
+            if (poll(fds, 3, -1) <= 0)
+                continue;
+            if (fds[1].revents)
+                return;
+            if (fds[2].revents) {
+                (void)!read(m_winch_pipe[0], buf, sizeof(buf));
+                m_resized.store(true, std::memory_order_relaxed);
+                OffscreenContext::wake();
+            }
+            if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n <= 0)
+                return; // the tty is gone, nothing more will arrive
+
+            m_parser.feed(
+                buf, static_cast<size_t>(n),
+                [this](const InputEvent &event) {
+                    if (event.type == InputEvent::Type::CellSize ||
+                        event.type == InputEvent::Type::TextAreaSize) {
+                        size_report(event);
+                        return;
+                    }
+                    if (event.type == InputEvent::Type::MouseMove) {
+                        m_motion = event; // coalesced, queued before the next event
+                        m_motion_pending = true;
+                        return;
+                    }
+                    flush_motion();
+                    queue(m_events, event);
+                },
+                [this](const KittyReply &reply) { queue(m_replies, reply); });
+            flush_motion();
+
+            if (m_parser.quit_requested())
+                m_quit.store(true, std::memory_order_relaxed);
+            if (m_queued) {
+                m_queued = false;
+                OffscreenContext::wake();
+            }
+        }
+    }
+
+    auto size_report(const InputEvent &event) -> void {
+        const bool cell = event.type == InputEvent::Type::CellSize;
+        (cell ? m_cell_px_width : m_area_px_width)
+            .store(static_cast<int>(event.x), std::memory_order_relaxed);
+        (cell ? m_cell_px_height : m_area_px_height)
+            .store(static_cast<int>(event.y), std::memory_order_relaxed);
+        // a size change may follow from the answer, same as for SIGWINCH
+        m_resized.store(true, std::memory_order_relaxed);
+        m_queued = true;
+    }
+
+    auto flush_motion() -> void {
+        if (m_motion_pending) {
+            m_motion_pending = false;
+            queue(m_events, m_motion);
+        }
+    }
+
+    // A full queue means the render loop is stuck; wake it and wait rather than drop a
+    // key release.
+    template <typename Queue, typename T>
+    auto queue(Queue &target, const T &item) -> void {
+        while (!target.push(item)) {
+            OffscreenContext::wake();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        m_queued = true;
+    }
+
+    auto apply(ImGuiIO &io, const InputEvent &event) -> void {
+        using Type = InputEvent::Type;
+        switch (event.type) {
+        case Type::Key:
+            io.AddKeyEvent(ImGuiMod_Ctrl, event.mods & TtyParser::MOD_CTRL);
+            io.AddKeyEvent(ImGuiMod_Shift, event.mods & TtyParser::MOD_SHIFT);
+            io.AddKeyEvent(ImGuiMod_Alt, event.mods & TtyParser::MOD_ALT);
+            io.AddKeyEvent(ImGuiMod_Super, event.mods & TtyParser::MOD_SUPER);
+            io.AddKeyEvent(event.key, event.down);
+            break;
+        case Type::Text: io.AddInputCharacter(event.codepoint); break;
+        case Type::MouseMove:
+            if (event.pixels) {
+                io.AddMousePosEvent((event.x - 1) * m_scale_x, (event.y - 1) * m_scale_y);
+            } else {
+                // cell reports: aim at the middle of the cell
+                io.AddMousePosEvent((event.x - 0.5f) * m_cell_width,
+                                    (event.y - 0.5f) * m_cell_height);
+            }
+            break;
+        case Type::MouseButton: io.AddMouseButtonEvent(event.button, event.down); break;
+        case Type::MouseWheel: io.AddMouseWheelEvent(event.x, event.y); break;
+        case Type::Focus: io.AddFocusEvent(event.down); break;
+        case Type::CellSize:
+        case Type::TextAreaSize: break; // handled on the reader thread
+        }
+    }
+
+    // written by the SIGWINCH handler
+    static inline int s_winch_fd = -1;
+
+    float m_cell_width = 1;
+    float m_cell_height = 1;
+    float m_scale_x = 1;
+    float m_scale_y = 1;
+
+    // reader thread state
+    TtyParser m_parser;
+    InputEvent m_motion{};
+    bool m_motion_pending = false;
+    bool m_queued = false;
+
+    SpscQueue<InputEvent, QUEUE_SIZE> m_events;
+    SpscQueue<KittyReply, 16> m_replies;
+    std::atomic<bool> m_quit = false;
+    std::atomic<bool> m_resized = false;
+    std::atomic<int> m_cell_px_width = 0;
+    std::atomic<int> m_cell_px_height = 0;
+    std::atomic<int> m_area_px_width = 0;
+    std::atomic<int> m_area_px_height = 0;
+    int m_stop_pipe[2] = {-1, -1};
+    int m_winch_pipe[2] = {-1, -1};
+    std::thread m_thread;
+};
@@ -1,19 +1,31 @@
 #pragma once
 
+#include "base64.hpp"
+#include "stats.hpp"
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <poll.h>
 #include <string>
+#include <string_view>
 #include <sys/ioctl.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <unistd.h>
 #include <zlib.h>
 
 /*
  * Ghostty has no planned support for animation. Animations are implemented `client-side`.
- * See how `terminal-doom` does it.
+ * See how `terminal-doom` does it. animation.hpp can do either.
  * Keys and what they mean
  * 'z=' animation related. defines the gap for frame, in milliseconds, before next frame
  * NOTE: we must define z= for frames that we want to be shown!
@@ -23,43 +35,6 @@
 #define CSI "\x1B["
 #define ESC "\x1B"
 
-const uint8_t base64enc_tab[] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-
-int base64_encode(size_t in_len, const uint8_t *in, size_t out_len, char *out) {
-    uint ii, io;
-    uint_least32_t v;
-    uint rem;
-
-    for (io = 0, ii = 0, v = 0, rem = 0; ii < in_len; ii++) {
-        uint8_t ch;
-        ch = in[ii];
-        v = (v << 8) | ch;
-        rem += 8;
-        while (rem >= 6) {
-            rem -= 6;
-            if (io >= out_len)
-                return -1; /* truncation is failure */
-            out[io++] = static_cast<char>(base64enc_tab[(v >> rem) & 63]);
-        }
-    }
-    if (rem) {
-        v <<= (6 - rem);
-        if (io >= out_len)
-            return -1; /* truncation is failure */
-        out[io++] = static_cast<char>(base64enc_tab[v & 63]);
-    }
-    while (io & 3) {
-        if (io >= out_len)
-            return -1; /* truncation is failure */
-        out[io++] = '=';
-    }
-    if (io >= out_len)
-        return -1; /* no room for null terminator */
-    out[io] = 0;
-    return io;
-}
-
 void restore_terminal();
 
 static struct termios orig_termios;
@@ -93,137 +68,542 @@ void setup_terminal() {
 void restore_terminal() {
     tcsetattr(STDIN_FILENO, TCSANOW, &orig_termios);
 
+    // undo TtyInput: pop the kitty keyboard flags, stop mouse and focus reports
+    std::cout << CSI << "<u" << CSI << "?1004l" << CSI << "?1016l" << CSI << "?1006l"
+              << CSI << "?1003l";
+
     std::cout << CSI << "?25h";   // show cursor
     std::cout << CSI << "?1049l"; // exit alt screen
     std::cout << CSI << "u";      // restore cursor
     std::cout.flush();
 }
 
+// Terminal size from TIOCGWINSZ. `width`/`height` are the text area in pixels and stay 0
+// on terminals that leave ws_xpixel/ws_ypixel unset; ask with CSI 14t/16t there.
+struct TerminalSize {
+    int cols = 0;
+    int rows = 0;
+    int width = 0;
+    int height = 0;
+};
+
+inline auto terminal_size() -> TerminalSize {
+    struct winsize ws = {};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 &&
+        ioctl(STDIN_FILENO, TIOCGWINSZ, &ws) != 0)
+        return {};
+    return {ws.ws_col, ws.ws_row, ws.ws_xpixel, ws.ws_ypixel};
+}
+
+/*
+ * Streams graphics escape codes straight to the tty fd. The payload is base64 encoded
+ * one chunk at a time into a fixed ring of chunk slots; the `ESC _G ... ;` framing is
+ * gathered around each slot with iovecs and the whole batch goes out with writev once
+ * the ring is full or on flush(). Nothing is allocated after construction.
+ */
+class KittyWriter {
+public:
+    static constexpr size_t CHUNK_LIMIT = 4096;              // base64 bytes per code
+    static constexpr size_t RAW_CHUNK = CHUNK_LIMIT / 4 * 3; // payload bytes per code
+    static constexpr size_t RING_CHUNKS = 64;                // chunks per writev batch
+    static constexpr size_t SLOT_SIZE = CHUNK_LIMIT + 64;    // room for the terminator
+    static constexpr size_t CONTROL_SIZE = 4096;             // commands, control codes
+
+    explicit KittyWriter(int fd = STDOUT_FILENO)
+        : m_fd(fd), m_ring(new char[RING_CHUNKS * SLOT_SIZE]) {
+    }
+
+    KittyWriter(const KittyWriter &) = delete;
+    KittyWriter &operator=(const KittyWriter &) = delete;
+
+    ~KittyWriter() {
+        flush();
+    }
+
+    // Queues one graphics command with an optional payload. The command is copied and the
+    // payload encoded right away, so neither has to outlive the call. Returns the number
+    // of base64 bytes queued.
+    auto send(std::string_view cmd, const uint8_t *payload = nullptr, size_t size = 0)
+        -> size_t {
+        if (cmd.size() > CONTROL_SIZE) {
+            std::cerr << "Graphics command too long: " << cmd.size() << " bytes\n";
+            return 0;
+        }
+        if (!payload || size == 0) {
+            reserve(0, 3, cmd.size());
+            push(APC_START);
+            push(stage(cmd));
+            push(ST);
+            return 0;
+        }
+
+        return send_chunks(cmd, size, [payload](size_t offset, size_t) {
+            return payload + offset;
+        });
+    }
+
+    // Like send(), but the payload is `rows` rows of `row_bytes` stored bottom-up, as
+    // glReadPixels returns them. Rows are gathered in reverse order while encoding, so no
+    // flipped copy of the frame is ever made.
+    auto send_bottom_up(std::string_view cmd, const uint8_t *data, size_t row_bytes,
+                        size_t rows) -> size_t {
+        if (!data || row_bytes == 0 || rows == 0)
+            return send(cmd);
+        return send_chunks(cmd, row_bytes * rows, [&](size_t offset, size_t length) {
+            size_t row = offset / row_bytes;
+            size_t column = offset % row_bytes;
+            const uint8_t *src = data + (rows - 1 - row) * row_bytes + column;
+            if (column + length <= row_bytes)
+                return src; // chunk lies within one row
+            for (size_t copied = 0; copied < length; row++, column = 0) {
+                size_t n = std::min(row_bytes - column, length - copied);
+                std::memcpy(m_gather + copied,
+                            data + (rows - 1 - row) * row_bytes + column, n);
+                copied += n;
+            }
+            return static_cast<const uint8_t *>(m_gather);
+        });
+    }
+
+    // Queues a short non-graphics sequence (cursor movement etc.) so it stays ordered
+    // with the frame data. The bytes are copied.
+    auto write_control(std::string_view seq) -> void {
+        if (seq.size() > CONTROL_SIZE) {
+            flush();
+            reserve(0, 1, 0);
+            push(seq);
+            flush();
+            return;
+        }
+        reserve(0, 1, seq.size());
+        push(stage(seq));
+    }
+
+    // Writes everything queued so far. Returns false if the fd reported an error.
+    auto flush() -> bool {
+        // anything still sitting in std::cout goes first to keep the stream ordered
+        std::cout.flush();
+
+        bool ok = true;
+        iovec *iov = m_iov;
+        int count = static_cast<int>(m_iov_count);
+        std::optional<StageTimer> timer;
+        if (count > 0)
+            timer.emplace(Stage::Write);
+        size_t written = 0;
+        while (count > 0) {
+            ssize_t n = ::writev(m_fd, iov, count);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    pollfd pfd = {m_fd, POLLOUT, 0};
+                    poll(&pfd, 1, -1);
+                    continue;
+                }
+                ok = false;
+                break;
+            }
+            auto left = static_cast<size_t>(n);
+            written += left;
+            while (count > 0 && left >= iov->iov_len) {
+                left -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + left;
+                iov->iov_len -= left;
+            }
+            m_syscalls++;
+        }
+        if (timer)
+            timer->set_bytes(written, written);
+
+        m_iov_count = 0;
+        m_used_chunks = 0;
+        m_control_used = 0;
+        return ok;
+    }
+
+    [[nodiscard]] auto fd() const -> int {
+        return m_fd;
+    }
+
+    // Number of writev calls issued so far.
+    [[nodiscard]] auto syscalls() const -> size_t {
+        return m_syscalls;
+    }
+
+private:
+    static constexpr std::string_view APC_START = ESC "_G";
+    static constexpr std::string_view ST = ESC "\\";
+    static constexpr size_t IOV_PER_CHUNK = 5;
+    static constexpr size_t MAX_IOV = RING_CHUNKS * IOV_PER_CHUNK;
+
+    // Encodes `size` payload bytes chunk by chunk; `source(offset, length)` returns a
+    // pointer to that many contiguous payload bytes.
+    template <typename Source>
+    auto send_chunks(std::string_view cmd, size_t size, Source &&source) -> size_t {
+        if (cmd.size() > CONTROL_SIZE) {
+            std::cerr << "Graphics command too long: " << cmd.size() << " bytes\n";
+            return 0;
+        }
+        // Continuation chunks of animation frames must repeat a=f. The quiet level is
+        // taken from the chunk that completes the command, so q= is repeated as well.
+        char keys[16];
+        size_t keys_len = 0;
+        if (has_key(cmd, "a=f")) {
+            std::memcpy(keys, "a=f,", 4);
+            keys_len = 4;
+        }
+        for (std::string_view quiet : {"q=1", "q=2"}) {
+            if (has_key(cmd, quiet)) {
+                std::memcpy(keys + keys_len, quiet.data(), 3);
+                keys[keys_len + 3] = ',';
+                keys_len += 4;
+            }
+        }
+
+        size_t encoded_total = 0;
+        for (size_t offset = 0; offset < size; offset += RAW_CHUNK) {
+            // make room up front so a flush never lands in the middle of an escape code
+            reserve(1, IOV_PER_CHUNK, offset == 0 ? cmd.size() : keys_len);
+
+            size_t raw = std::min(RAW_CHUNK, size - offset);
+            bool last = offset + raw >= size;
+
+            char *slot = m_ring.get() + m_used_chunks * SLOT_SIZE;
+            int encoded;
+            {
+                StageTimer timer(Stage::Encode, raw);
+                encoded = base64_encode(raw, source(offset, raw), SLOT_SIZE, slot);
+                timer.set_bytes_out(encoded > 0 ? encoded : 0);
+            }
+            if (encoded < 0) {
+                std::cerr << "Error: base64_encode failed: ret=" << encoded << "\n";
+                // the chunks before this one (possibly flushed already) announced more
+                // to come: end the command with an empty chunk, or the terminal takes
+                // the next command as its continuation
+                if (offset > 0) {
+                    reserve(0, 4, keys_len);
+                    push(APC_START);
+                    if (keys_len > 0)
+                        push(stage({keys, keys_len}));
+                    push("m=0;");
+                    push(ST);
+                }
+                return encoded_total;
+            }
+            m_used_chunks++;
+
+            if (offset == 0) {
+                push(APC_START);
+                push(stage(cmd));
+                push(last ? ",m=0;" : ",m=1;");
+            } else {
+                push(APC_START);
+                if (keys_len > 0)
+                    push(stage({keys, keys_len}));
+                push(last ? "m=0;" : "m=1;");
+            }
+            push(std::string_view(slot, encoded));
+            push(ST);
+
+            encoded_total += encoded;
+        }
+        return encoded_total;
+    }
+
+    static auto has_key(std::string_view cmd, std::string_view key) -> bool {
+        for (size_t pos = cmd.find(key); pos != std::string_view::npos;
+             pos = cmd.find(key, pos + 1)) {
+            size_t end = pos + key.size();
+            bool starts = pos == 0 || cmd[pos - 1] == ',';
+            if (starts && (end == cmd.size() || cmd[end] == ','))
+                return true;
+        }
+        return false;
+    }
+
+    // Flushes first if the batch has no room left for `chunks` ring slots, `iovs` iovecs
+    // and `bytes` staged bytes.
+    auto reserve(size_t chunks, size_t iovs, size_t bytes) -> void {
+        if (m_used_chunks + chunks > RING_CHUNKS || m_iov_count + iovs > MAX_IOV ||
+            m_control_used + bytes > CONTROL_SIZE)
+            flush();
+    }
+
+    // Copies small strings into the staging area; room must have been reserve()d.
+    auto stage(std::string_view bytes) -> std::string_view {
+        char *dst = m_control + m_control_used;
+        std::memcpy(dst, bytes.data(), bytes.size());
+        m_control_used += bytes.size();
+        return {dst, bytes.size()};
+    }
+
+    auto push(std::string_view bytes) -> void {
+        assert(m_iov_count < MAX_IOV);
+        if (!bytes.empty())
+            m_iov[m_iov_count++] = {const_cast<char *>(bytes.data()), bytes.size()};
+    }
+
+    int m_fd;
+    std::unique_ptr<char[]> m_ring;
+    size_t m_used_chunks = 0;
+    uint8_t m_gather[RAW_CHUNK]; // one chunk of payload spanning several rows
+    char m_control[CONTROL_SIZE];
+    size_t m_control_used = 0;
+    iovec m_iov[MAX_IOV];
+    size_t m_iov_count = 0;
+    size_t m_syscalls = 0;
+};
+
+// Writer on stdout shared by the free functions below.
+inline auto kitty_writer() -> KittyWriter & {
+    static KittyWriter writer(STDOUT_FILENO);
+    return writer;
+}
+
+/*
+ * One image on the terminal under a stable image id and placement id. Sending every
+ * frame without an id makes the terminal allocate a new image each time until its
+ * storage quota forces evictions; reusing the ids keeps its memory flat. The first frame
+ * transmits and places the image (upload_keys()), later ones either edit its root frame
+ * in place (edit_keys(), or blend_keys() to alpha blend the edit onto it) or upload
+ * again under the same ids, which replaces the data. remove() (also run by the
+ * destructor) deletes the image and frees its data.
+ */
+class KittyImage {
+public:
+    static constexpr uint32_t PLACEMENT_ID = 1;
+
+    KittyImage() : m_id(s_next_id.fetch_add(1, std::memory_order_relaxed)) {
+        std::snprintf(m_upload_keys, sizeof(m_upload_keys), "a=T,i=%u,p=%u", m_id,
+                      PLACEMENT_ID);
+        std::snprintf(m_edit_keys, sizeof(m_edit_keys), "a=f,r=1,X=1,i=%u", m_id);
+        std::snprintf(m_blend_keys, sizeof(m_blend_keys), "a=f,r=1,i=%u", m_id);
+    }
+
+    KittyImage(const KittyImage &) = delete;
+    KittyImage &operator=(const KittyImage &) = delete;
+
+    ~KittyImage() {
+        remove();
+    }
+
+    [[nodiscard]] auto id() const -> uint32_t {
+        return m_id;
+    }
+
+    // True until a frame was uploaded, and again after invalidate() or remove().
+    [[nodiscard]] auto needs_upload() const -> bool {
+        return !m_uploaded;
+    }
+
+    // Keys that transmit and place a whole frame; marks the image as uploaded.
+    [[nodiscard]] auto upload_keys() -> const char * {
+        m_uploaded = true;
+        m_shown = true;
+        return m_upload_keys;
+    }
+
+    // For data sent with keys of the caller's own (e.g. a=t, transmit only): marks the
+    // image as uploaded so remove() frees it.
+    auto mark_uploaded() -> void {
+        m_uploaded = true;
+        m_shown = true;
+    }
+
+    // Keys that replace a rectangle of the uploaded frame (add x=, y=, s=, v=).
+    [[nodiscard]] auto edit_keys() const -> const char * {
+        assert(m_uploaded);
+        return m_edit_keys;
+    }
+
+    // Keys that alpha blend a rectangle onto the uploaded frame (add x=, y=, s=, v=):
+    // transparent pixels leave the frame as it was.
+    [[nodiscard]] auto blend_keys() const -> const char * {
+        assert(m_uploaded);
+        return m_blend_keys;
+    }
+
+    // The terminal's copy no longer matches what the sender assumes (e.g. the size
+    // changed); the next frame has to be uploaded whole.
+    auto invalidate() -> void {
+        m_uploaded = false;
+    }
+
+    // Deletes the placement and frees the image data on the terminal.
+    auto remove(KittyWriter &writer = kitty_writer()) -> void {
+        if (!m_shown)
+            return;
+        char cmd[48];
+        int length = std::snprintf(cmd, sizeof(cmd), "a=d,d=I,i=%u,q=2", m_id);
+        writer.send({cmd, static_cast<size_t>(length)});
+        writer.flush();
+        m_shown = false;
+        m_uploaded = false;
+    }
+
+private:
+    static inline std::atomic<uint32_t> s_next_id = 1;
+
+    uint32_t m_id;
+    bool m_uploaded = false;
+    bool m_shown = false;
+    char m_upload_keys[32];
+    char m_edit_keys[32];
+    char m_blend_keys[32];
+};
+
 auto kitty_send_command(const std::string &cmd_str, const uint8_t *payload_data = nullptr,
                         size_t payload_size = 0) -> size_t {
-    constexpr size_t chunk_limit = 4096;
+    KittyWriter &writer = kitty_writer();
+    size_t sent = writer.send(cmd_str, payload_data, payload_size);
+    writer.flush();
+    return sent;
+}
 
-    if (!payload_data || payload_size == 0) {
-        // Just send the command without payload
-        std::cout << ESC << "_G" << cmd_str << "\\";
-        std::cout.flush();
-        return 0;
-    }
-
-    // Prepare base64 data
-    size_t base64_size = ((payload_size + 2) / 3) * 4;
-    auto base64_data = (uint8_t *)malloc(base64_size + 1);
-    if (!base64_data) {
-        std::cerr << "Failed to allocate memory for base64 encoding\n";
-        return 0;
-    }
-
-    int ret =
-        base64_encode(payload_size, payload_data, base64_size + 1, (char *)base64_data);
-    if (ret < 0) {
-        std::cerr << "Error: base64_encode failed: ret=" << ret << "\n";
-        free(base64_data);
-        return 0;
-    }
-
-    // Send data in chunks
-    size_t sent_bytes = 0;
-    std::size_t chunks = 0;
-    while (sent_bytes < base64_size) {
-        size_t chunk_size = std::min(chunk_limit, base64_size - sent_bytes);
-        bool is_last_chunk = (sent_bytes + chunk_size >= base64_size);
-
-        if (sent_bytes == 0) {
-            // First chunk includes the command
-            std::cout << ESC << "_G" << cmd_str << ",m=" << (is_last_chunk ? "0" : "1")
-                      << ";";
-        } else {
-            // Continuation chunks
-            std::cout << ESC << "_Gm=" << (is_last_chunk ? "0" : "1") << ";";
+// A terminal response to a graphics command: `ESC _G i=<id>[,p=<pid>];<message> ESC \`
+struct KittyReply {
+    uint32_t image_id = 0;
+    uint32_t placement_id = 0;
+    bool ok = false;
+    char message[128] = {};
+};
+
+// Parses the body of a reply (the bytes between `ESC _G` and `ESC \`).
+inline auto kitty_parse_reply(std::string_view body, KittyReply &reply) -> bool {
+    size_t semi = body.find(';');
+    if (semi == std::string_view::npos)
+        return false;
+
+    reply = KittyReply{};
+    std::string_view keys = body.substr(0, semi);
+    while (!keys.empty()) {
+        size_t comma = keys.find(',');
+        std::string_view kv = keys.substr(0, comma);
+        if (kv.size() > 2 && kv[1] == '=') {
+            uint32_t value = 0;
+            for (char c : kv.substr(2)) {
+                if (c < '0' || c > '9')
+                    break;
+                value = value * 10 + static_cast<uint32_t>(c - '0');
+            }
+            if (kv[0] == 'i')
+                reply.image_id = value;
+            else if (kv[0] == 'p')
+                reply.placement_id = value;
         }
+        keys = comma == std::string_view::npos ? std::string_view()
+                                               : keys.substr(comma + 1);
+    }
 
-        std::cout.write((char *)base64_data + sent_bytes, chunk_size);
-        std::cout << ESC << "\\";
-        std::cout.flush();
+    std::string_view message = body.substr(semi + 1);
+    reply.ok = message == "OK";
+    size_t n = std::min(message.size(), sizeof(reply.message) - 1);
+    std::memcpy(reply.message, message.data(), n);
+    reply.message[n] = 0;
+    return true;
+}
 
-        chunks++;
+/*
+ * Incremental parser for what the terminal writes back on stdin. Keeps its state and any
+ * unparsed bytes between calls, so replies split across reads or arriving back to back
+ * are not lost. Anything that is not a graphics reply or a primary device attributes
+ * answer is discarded. Expects the tty in raw mode.
+ */
+class KittyReplyReader {
+public:
+    enum class Event { None, Reply, DeviceAttributes };
+
+    // Returns the next graphics reply or device attributes answer (`CSI ? ... c`),
+    // waiting at most `timeout_ms` for input; Event::None on timeout. 0 only drains what
+    // is already readable.
+    auto read(int timeout_ms, KittyReply &reply) -> Event {
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        for (;;) {
+            Event event = parse(reply);
+            if (event != Event::None)
+                return event;
+
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+            int wait_ms = static_cast<int>(std::max<int64_t>(0, left.count()));
+            if (poll(&pfd, 1, wait_ms) <= 0) {
+                if (left.count() <= 0)
+                    return Event::None;
+                continue;
+            }
+            ssize_t n = ::read(STDIN_FILENO, m_buf, sizeof(m_buf));
+            if (n <= 0)
+                return Event::None;
+            m_pos = 0;
+            m_len = static_cast<size_t>(n);
+        }
+    }
 
-        sent_bytes += chunk_size;
+private:
+    enum class State { Ground, Esc, Apc, ApcEsc, Csi };
+
+    auto parse(KittyReply &reply) -> Event {
+        while (m_pos < m_len) {
+            char c = m_buf[m_pos++];
+            switch (m_state) {
+            case State::Ground: m_state = c == '\x1B' ? State::Esc : State::Ground; break;
+            case State::Esc:
+                if (c == '_') {
+                    m_state = State::Apc;
+                    m_body_len = 0;
+                } else {
+                    m_state = c == '[' ? State::Csi : State::Ground;
+                }
+                break;
+            case State::Apc:
+                if (c == '\x1B')
+                    m_state = State::ApcEsc;
+                else if (m_body_len < sizeof(m_body))
+                    m_body[m_body_len++] = c;
+                break;
+            case State::ApcEsc:
+                m_state = State::Ground;
+                if (c == '\\' && m_body_len > 0 && m_body[0] == 'G' &&
+                    kitty_parse_reply({m_body + 1, m_body_len - 1}, reply))
+                    return Event::Reply;
+                break;
+            case State::Csi:
+                if (c == 'c') {
+                    m_state = State::Ground;
+                    return Event::DeviceAttributes;
+                }
+                if (c >= 0x40 && c <= 0x7E)
+                    m_state = State::Ground;
+                break;
+            }
+        }
+        return Event::None;
     }
 
-    free(base64_data);
-    return base64_size;
+    State m_state = State::Ground;
+    char m_body[256];
+    size_t m_body_len = 0;
+    char m_buf[256];
+    size_t m_pos = 0;
+    size_t m_len = 0;
+};
+
+// Shared reader for stdin, so bytes read past one reply are still there for the next.
+inline auto kitty_reply_reader() -> KittyReplyReader & {
+    static KittyReplyReader reader;
+    return reader;
 }
 
-// int main(int argc, char **argv) {
-//     if (argc < 2) {
-//         std::cerr << "Usage: " << argv[0] << " <gif_path>" << std::endl;
-//         return 1;
-//     }
-//     const char *gif_path = argv[1];
-
-//     std::this_thread::sleep_for(std::chrono::seconds(1));
-
-//     setup_terminal();
-
-//     std::ifstream file(gif_path, std::ios::binary | std::ios::ate);
-//     if (!file) {
-//         std::cerr << "Failed to open file: " << gif_path << std::endl;
-//         restore_terminal();
-//         return EXIT_FAILURE;
-//     }
-
-//     std::streamsize size = file.tellg();
-//     file.seekg(0, std::ios::beg);
-
-//     std::vector<unsigned char> buffer(size);
-//     if (!file.read(reinterpret_cast<char *>(buffer.data()), size)) {
-//         std::cerr << "Failed to read file: " << gif_path << std::endl;
-//         restore_terminal();
-//         return EXIT_FAILURE;
-//     }
-
-//     int *delays = nullptr;
-//     int width, height, frames, channels;
-//     unsigned char *data = stbi_load_gif_from_memory(buffer.data(), size, &delays, &width,
-//                                                     &height, &frames, &channels, 4);
-
-//     if (!data) {
-//         std::cerr << "Failed to load GIF: " << gif_path << std::endl;
-//         restore_terminal();
-//         return EXIT_FAILURE;
-//     }
-
-//     for (int i = 0; i < frames; i++) {
-//         // Each frame is width * height * 4 bytes (RGBA)
-//         size_t frame_size = width * height * 4;
-//         unsigned char *frame_data = data + (i * frame_size);
-
-//         // Compress the frame data using zlib
-//         uLongf compressed_size = compressBound(frame_size);
-//         unsigned char *compressed_data = (unsigned char *)malloc(compressed_size);
-//         if (compress2(compressed_data, &compressed_size, frame_data, frame_size,
-//                       Z_BEST_COMPRESSION) != Z_OK) {
-//             std::cerr << "Failed to compress frame data" << std::endl;
-//             free(compressed_data);
-//             continue;
-//         }
-
-//         // a=T means "simultaneously transmit and display an image"
-//         std::string cmd =
-//             "a=T,o=z,f=32,s=" + std::to_string(width) + ",v=" + std::to_string(height);
-//         kitty_send_command(cmd, compressed_data, compressed_size);
-//         free(compressed_data);
-//         std::cout << CSI << "H"; // move cursor to the top left
-
-//         // Sleep for the frame delay
-//         if (i < frames - 1) {         // Don't sleep after the last frame
-//             int delay_ms = delays[i]; // Convert from 1/100th of a second to milliseconds
-//             std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
-//         }
-//     }
-//     // Clean up
-//     stbi_image_free(data);
-//     restore_terminal();
-//     return 0;
-// }
+// Reads stdin until a graphics reply arrives, the terminal answers a primary device
+// attributes query (meaning it skipped our graphics command) or the timeout expires.
+inline auto kitty_wait_reply(int timeout_ms, KittyReply &reply) -> bool {
+    return kitty_reply_reader().read(timeout_ms, reply) ==
+           KittyReplyReader::Event::Reply;
+}
@@ -0,0 +1,670 @@
+#include "deflate.hpp"
+#include "delta.hpp"
+#include "diff.hpp"
+#include "format.hpp"
+#include "kgp.hpp"
+#include "raster.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <string_view>
+#include <vector>
+
+/*
+ * Small in-tree benchmark for the encode/transport hot path. Needs no GL context or
+ * terminal, so it runs anywhere. Each case reports the best of a few repetitions.
+ *
+ * Usage: kgp_bench [section...], sections being base64, send, flip, zlib, diff, formats,
+ * delta and raster; all of them by default. Frames are synthetic: an ImGui-like grid,
+ * noise and a solid fill, at an 80x24 terminal of 10x20 cells and at the default gui.cpp
+ * size. The raster section draws hand-built ImDrawData with the CPU renderer. A blend
+ * kernel that disagrees with its scalar reference makes the run exit with 1.
+ */
+
+namespace {
+
+constexpr int REPEATS = 5;
+// slow cases stop repeating once they have used this much time
+constexpr double TIME_BUDGET_S = 1.0;
+
+template <typename F>
+auto best_seconds(F &&fn) -> double {
+    double best = 1e30;
+    double total = 0;
+    for (int i = 0; i < REPEATS && total < TIME_BUDGET_S; i++) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+        total += elapsed.count();
+    }
+    return best;
+}
+
+struct FrameSize {
+    const char *name;
+    int width;
+    int height;
+    int cell_width;
+    int cell_height;
+};
+
+constexpr FrameSize SIZES[] = {
+    {"80x24 cells of 10x20 px", 80 * 10, 24 * 20, 10, 20},
+    // default gui.cpp framebuffer
+    {"159x42 cells of 24x48 px", 159 * 24, 42 * 48, 24, 48},
+};
+
+auto make_noise_frame(int width, int height) -> std::vector<uint8_t> {
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 4);
+    std::mt19937 rng(42);
+    for (auto &byte : frame)
+        byte = static_cast<uint8_t>(rng());
+    return frame;
+}
+
+// Flat background with a translucent white cell grid, roughly what GUI::frame() draws.
+auto make_grid_frame(int width, int height, int cell_width = 24, int cell_height = 48)
+    -> std::vector<uint8_t> {
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 4);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *px = frame.data() + (static_cast<size_t>(y) * width + x) * 4;
+            bool line = x % cell_width == 0 || y % cell_height == 0;
+            px[0] = line ? 150 : 115;
+            px[1] = line ? 168 : 140;
+            px[2] = line ? 178 : 153;
+            px[3] = 255;
+        }
+    }
+    return frame;
+}
+
+auto make_solid_frame(int width, int height) -> std::vector<uint8_t> {
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 4);
+    for (size_t i = 0; i < frame.size(); i += 4) {
+        frame[i + 0] = 115;
+        frame[i + 1] = 140;
+        frame[i + 2] = 153;
+        frame[i + 3] = 255;
+    }
+    return frame;
+}
+
+void bench_base64(const std::vector<uint8_t> &frame) {
+    std::vector<char> expected(base64_encoded_size(frame.size()) + 1);
+    std::vector<char> out(expected.size());
+    base64_encode_scalar(frame.size(), frame.data(), expected.size(), expected.data());
+
+    std::printf("base64_encode (%zu bytes in), active path: %s\n", frame.size(),
+                base64_path_name(base64_active_path()));
+    for (auto path : {Base64Path::Scalar, Base64Path::SSSE3, Base64Path::AVX2,
+                      Base64Path::AVX512VBMI, Base64Path::NEON}) {
+        if (!base64_path_supported(path))
+            continue;
+        auto fn = base64_path_fn(path);
+        double secs =
+            best_seconds([&] { fn(frame.size(), frame.data(), out.size(), out.data()); });
+        bool identical = std::memcmp(out.data(), expected.data(), out.size()) == 0;
+        std::printf("  %-12s %10.1f MB/s%s\n", base64_path_name(path),
+                    frame.size() / secs / 1e6, identical ? "" : "  OUTPUT MISMATCH");
+    }
+}
+
+void bench_zlib(const char *name, const std::vector<uint8_t> &frame) {
+    std::printf("zlib, %s frame (%zu bytes in)\n", name, frame.size());
+    std::vector<uint8_t> out(compressBound(frame.size()));
+    ParallelDeflate parallel;
+
+    for (int level : {1, 3, 6, 9}) {
+        uLongf serial_size = out.size();
+        double serial = best_seconds([&] {
+            serial_size = out.size();
+            compress2(out.data(), &serial_size, frame.data(), frame.size(), level);
+        });
+
+        parallel.set_level(level);
+        size_t parallel_size = 0;
+        double threaded = best_seconds([&] {
+            parallel_size = parallel.compress(frame.data(), frame.size()).size();
+        });
+
+        std::printf("  level %d  compress2 %9lu bytes %8.2f ms/frame   "
+                    "parallel %9zu bytes %8.2f ms/frame\n",
+                    level, serial_size, serial * 1e3, parallel_size, threaded * 1e3);
+    }
+}
+
+// Strips the alpha channel for the three channel formats.
+auto convert_frame(const std::vector<uint8_t> &rgba, PixelFormat format)
+    -> std::vector<uint8_t> {
+    if (format == PixelFormat::RGBA)
+        return rgba;
+    std::vector<uint8_t> rgb(rgba.size() / 4 * 3);
+    for (size_t i = 0, o = 0; i < rgba.size(); i += 4, o += 3)
+        std::memcpy(rgb.data() + o, rgba.data() + i, 3);
+    return rgb;
+}
+
+// Bytes on the wire per pixel format, at the pipeline's default level. The time covers
+// what the compress thread does with a frame: quantizing (palette) and deflating. Only
+// full uploads and KGP_DELTA=off edits are sent in the format; delta edits are RGBA.
+void bench_formats(const char *name, const std::vector<uint8_t> &frame) {
+    std::printf("formats, %s frame (full uploads, and edits with KGP_DELTA=off)\n", name);
+    // background and grid lines of make_grid_frame()
+    const std::array<float, 4> colors[] = {{0.45f, 0.55f, 0.60f, 1.0f},
+                                           {1.0f, 1.0f, 1.0f, 0.25f}};
+    const PaletteQuantizer quantizer =
+        PaletteQuantizer::from_style(colors, {0.45f, 0.55f, 0.60f});
+    ParallelDeflate parallel;
+    parallel.set_level(zlib_level_from_env());
+
+    for (auto format : {PixelFormat::RGBA, PixelFormat::RGB, PixelFormat::Palette}) {
+        const std::vector<uint8_t> pixels = convert_frame(frame, format);
+        std::vector<uint8_t> work(pixels.size());
+        size_t compressed = 0;
+        double secs = best_seconds([&] {
+            std::memcpy(work.data(), pixels.data(), pixels.size());
+            if (format == PixelFormat::Palette)
+                quantizer.apply(work.data(), work.size() / 3);
+            compressed = parallel.compress(work.data(), work.size()).size();
+        });
+        std::printf("  %-8s f=%d  raw %9zu  zlib %9zu  base64 %9zu bytes"
+                    " %8.2f ms/frame\n",
+                    pixel_format_name(format), pixel_format_key(format), pixels.size(),
+                    compressed, base64_encoded_size(compressed), secs * 1e3);
+    }
+}
+
+// What kitty_send_command() does with a frame (chunking, base64, writev, flush), with
+// /dev/null standing in for the tty so only our side of the write is measured.
+void bench_send(const std::vector<uint8_t> &frame) {
+    int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::perror("open /dev/null");
+        return;
+    }
+    KittyWriter writer(fd);
+    writer.send("a=T,f=32", frame.data(), frame.size()); // warm up
+    writer.flush();
+
+    const size_t syscalls = writer.syscalls();
+    double secs = best_seconds([&] {
+        writer.send("a=T,i=1,p=1,q=2,f=32", frame.data(), frame.size());
+        writer.flush();
+    });
+    std::printf("  send+flush %9zu bytes %10.1f MB/s %8.2f ms/frame (%zu writev)\n",
+                frame.size(), frame.size() / secs / 1e6, secs * 1e3,
+                writer.syscalls() - syscalls);
+    close(fd);
+}
+
+// Bottom-up rows to top-down: flipped on the CPU into a copy, and gathered in reverse
+// while encoding by send_bottom_up(). gui.cpp flips on the GPU instead.
+void bench_flip(const std::vector<uint8_t> &frame, int width, int height) {
+    const size_t row = static_cast<size_t>(width) * 4;
+    std::vector<uint8_t> flipped(frame.size());
+    double copy = best_seconds([&] {
+        for (int y = 0; y < height; y++)
+            std::memcpy(flipped.data() + y * row, frame.data() + (height - 1 - y) * row,
+                        row);
+    });
+
+    int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        std::perror("open /dev/null");
+        return;
+    }
+    KittyWriter writer(fd);
+    double gathered = best_seconds([&] {
+        writer.send_bottom_up("a=T,f=32", frame.data(), row, height);
+        writer.flush();
+    });
+    double straight = best_seconds([&] {
+        writer.send("a=T,f=32", frame.data(), frame.size());
+        writer.flush();
+    });
+    std::printf("  row copy %8.2f ms   send_bottom_up %8.2f ms   send %8.2f ms\n",
+                copy * 1e3, gathered * 1e3, straight * 1e3);
+    close(fd);
+}
+
+// FrameDiff::update() on an idle frame, one changed cell and a completely new frame.
+void bench_diff(const FrameSize &size) {
+    const auto grid = make_grid_frame(size.width, size.height, size.cell_width,
+                                      size.cell_height);
+    const auto noise = make_noise_frame(size.width, size.height);
+    auto cell = grid;
+    for (int y = size.cell_height; y < 2 * size.cell_height; y++) {
+        uint8_t *px = cell.data() + (static_cast<size_t>(y) * size.width +
+                                     size.cell_width) * 4;
+        std::memset(px, 255, static_cast<size_t>(size.cell_width) * 4);
+    }
+
+    FrameDiff differ(size.width, size.height);
+    differ.update(grid.data());
+    double idle = best_seconds([&] { differ.update(grid.data()); });
+
+    size_t cell_rects = 0;
+    double one_cell = best_seconds([&] {
+        cell_rects = differ.update(cell.data()).size();
+        differ.update(grid.data());
+    });
+
+    size_t full_rects = 0;
+    double full = best_seconds([&] {
+        full_rects = differ.update(noise.data()).size();
+        differ.update(grid.data());
+    });
+    // the last two cases run update() twice per repetition
+    std::printf("  idle %8.2f ms   one cell %8.2f ms (%zu rects)   "
+                "everything %8.2f ms (%zu rects)\n",
+                idle * 1e3, one_cell / 2 * 1e3, cell_rects, full / 2 * 1e3, full_rects);
+}
+
+// Bytes on the wire for the rectangles of a frame after the first, per DeltaMode, and
+// what the compress thread spends on them. The changes: a hovered cell, a line of text
+// and a new frame, each applied to the grid and undone again.
+void bench_delta(const FrameSize &size) {
+    const auto grid = make_grid_frame(size.width, size.height, size.cell_width,
+                                      size.cell_height);
+    auto hover = grid;
+    for (int y = size.cell_height + 1; y < 2 * size.cell_height; y++) {
+        for (int x = size.cell_width + 1; x < 4 * size.cell_width; x++) {
+            uint8_t *px = hover.data() + (static_cast<size_t>(y) * size.width + x) * 4;
+            px[0] = 66;
+            px[1] = 150;
+            px[2] = 250;
+        }
+    }
+    // dark glyph-like strokes over a line of cells, as when a label changes
+    auto text = grid;
+    std::mt19937 rng(7);
+    for (int cell = 2; cell < 40; cell++) {
+        const int x0 = cell * size.cell_width / 2;
+        for (int y = 3 * size.cell_height + 4; y < 4 * size.cell_height - 4; y++) {
+            for (int x = x0 + 1; x < x0 + size.cell_width / 2 - 1; x++) {
+                if (rng() % 3)
+                    continue;
+                uint8_t *px =
+                    text.data() + (static_cast<size_t>(y) * size.width + x) * 4;
+                px[0] = px[1] = px[2] = 230;
+            }
+        }
+    }
+    const auto noise = make_noise_frame(size.width, size.height);
+
+    ParallelDeflate deflater;
+    deflater.set_level(zlib_level_from_env());
+    PngEncoder png;
+    png.reserve(static_cast<size_t>(size.width) * size.height, size.height);
+
+    std::printf("delta encoding, after the first upload\n");
+    const std::pair<const char *, const std::vector<uint8_t> *> changes[] = {
+        {"hover", &hover}, {"text", &text}, {"noise", &noise}};
+    for (const auto &[name, frame] : changes) {
+        std::printf("  %-6s", name);
+        for (auto mode : {DeltaMode::Off, DeltaMode::Mask, DeltaMode::Png}) {
+            FrameDiff differ(size.width, size.height, 4, mode != DeltaMode::Off);
+            differ.update(grid.data());
+            size_t bytes = 0;
+            double secs = best_seconds([&] {
+                bytes = 0;
+                for (const auto &rect : differ.update(frame->data())) {
+                    auto region = mode == DeltaMode::Off
+                                      ? differ.extract(frame->data(), rect)
+                                      : differ.extract_delta(frame->data(), rect);
+                    bytes += mode == DeltaMode::Png
+                                 ? png.encode(region, rect.w, rect.h, deflater).size()
+                                 : deflater.compress(region.data(), region.size()).size();
+                }
+                differ.update(grid.data());
+            });
+            // update() runs twice per repetition, the undo is not counted
+            std::printf("  %-4s %9zu bytes %7.2f ms", delta_mode_name(mode), bytes,
+                        secs * 1e3);
+        }
+        std::printf("\n");
+    }
+}
+
+// ImDrawData put together by hand the way ImGui lays it out: each command indexes from
+// its own VtxOffset, quads are (a, b, c), (a, c, d), everything samples one atlas and
+// shapes take its white texels. The frame has translucent windows with a title bar,
+// buttons, antialiased radio buttons and plot lines, and a line of text every cell row.
+class SyntheticUi {
+public:
+    static constexpr int ATLAS_WIDTH = 512;
+    // two rows of 32 glyph cells, then a band of white texels
+    static constexpr int ATLAS_HEIGHT = 72;
+    static constexpr int GLYPH_WIDTH = 16;
+    static constexpr int GLYPH_HEIGHT = 32;
+
+    explicit SyntheticUi(const FrameSize &size)
+        : m_atlas(static_cast<size_t>(ATLAS_WIDTH) * ATLAS_HEIGHT * 4, 255),
+          m_texture{m_atlas.data(), ATLAS_WIDTH, ATLAS_HEIGHT},
+          m_white(1.5f / ATLAS_WIDTH, (2 * GLYPH_HEIGHT + 4.5f) / ATLAS_HEIGHT) {
+        std::mt19937 rng(11);
+        // glyph coverage in the alpha channel, a transparent texel around each glyph
+        for (int y = 0; y < 2 * GLYPH_HEIGHT; y++) {
+            for (int x = 0; x < ATLAS_WIDTH; x++) {
+                const int gx = x % GLYPH_WIDTH;
+                const int gy = y % GLYPH_HEIGHT;
+                const bool border = gx == 0 || gx == GLYPH_WIDTH - 1 || gy == 0 ||
+                                    gy == GLYPH_HEIGHT - 1;
+                m_atlas[(static_cast<size_t>(y) * ATLAS_WIDTH + x) * 4 + 3] =
+                    border || rng() % 3 == 0 ? 0 : static_cast<uint8_t>(rng());
+            }
+        }
+
+        const auto width = static_cast<float>(size.width);
+        const auto height = static_cast<float>(size.height);
+        const auto cell_width = static_cast<float>(size.cell_width);
+        const auto cell_height = static_cast<float>(size.cell_height);
+        for (int i = 0; i < 6; i++) {
+            const float x0 = std::floor(width * i / 8);
+            const float y0 = std::floor(height * i / 10);
+            const float x1 = x0 + std::floor(width / 3);
+            const float y1 = y0 + std::floor(height / 3);
+            command(x0, y0, x1, y1);
+            rect(x0, y0, x1, y1, 0xf0242424);
+            rect(x0, y0, x1, y0 + cell_height / 2, 0xff8a4a29);
+            for (float y = y0 + cell_height; y + cell_height / 2 < y1; y += cell_height) {
+                rect(x0 + cell_width, y, x0 + 5 * cell_width, y + cell_height / 2,
+                     0x66fa9642);
+                circle(x0 + 7 * cell_width, y + cell_height / 4, cell_height / 4,
+                       0xffe0e0e0);
+            }
+            ImVec2 from(x0 + 9 * cell_width, (y0 + y1) / 2);
+            for (int k = 0; k < 24; k++) {
+                const ImVec2 to(from.x + cell_width,
+                                (y0 + y1) / 2 + static_cast<float>(rng() % 64) - 32);
+                line(from, to, 0xff59b3ff);
+                from = to;
+            }
+        }
+        // clipped short of the right edge, like a table column
+        for (float y = cell_height / 4; y + cell_height / 2 <= height; y += cell_height) {
+            command(0, 0, width - 1.5f * cell_width, height);
+            const ImU32 color =
+                static_cast<int>(y / cell_height) % 2 ? 0xffffffff : 0xff80e0ff;
+            const float glyph_width = std::floor(cell_width / 2) - 2;
+            const float glyph_height = std::floor(cell_height / 2);
+            for (float x = cell_width / 4; x + cell_width / 2 <= width;
+                 x += cell_width / 2) {
+                const auto glyph = static_cast<int>(rng() % 64);
+                const auto u = static_cast<float>(glyph % 32 * GLYPH_WIDTH);
+                const auto v = static_cast<float>(glyph / 32 * GLYPH_HEIGHT);
+                quad(x, y, x + glyph_width, y + glyph_height,
+                     ImVec2(u / ATLAS_WIDTH, v / ATLAS_HEIGHT),
+                     ImVec2((u + glyph_width) / ATLAS_WIDTH,
+                            (v + glyph_height) / ATLAS_HEIGHT),
+                     color);
+            }
+        }
+
+        m_data.DisplaySize = ImVec2(width, height);
+        m_data.FramebufferScale = ImVec2(1, 1);
+        m_data.CmdLists.push_back(&m_list);
+        m_data.CmdListsCount = 1;
+    }
+
+    SyntheticUi(const SyntheticUi &) = delete;
+    SyntheticUi &operator=(const SyntheticUi &) = delete;
+
+    [[nodiscard]] auto draw_data() const -> const ImDrawData * {
+        return &m_data;
+    }
+
+    [[nodiscard]] auto vertices() const -> int {
+        return m_list.VtxBuffer.Size;
+    }
+
+    [[nodiscard]] auto indices() const -> int {
+        return m_list.IdxBuffer.Size;
+    }
+
+private:
+    auto command(float x0, float y0, float x1, float y1) -> void {
+        ImDrawCmd cmd;
+        cmd.ClipRect = ImVec4(x0, y0, x1, y1);
+        cmd.TextureId = m_texture.id();
+        cmd.VtxOffset = static_cast<unsigned>(m_list.VtxBuffer.Size);
+        cmd.IdxOffset = static_cast<unsigned>(m_list.IdxBuffer.Size);
+        m_list.CmdBuffer.push_back(cmd);
+    }
+
+    // Index of the new vertex within the current command.
+    auto vertex(ImVec2 pos, ImVec2 uv, ImU32 color) -> ImDrawIdx {
+        m_list.VtxBuffer.push_back({pos, uv, color});
+        const auto first = static_cast<int>(m_list.CmdBuffer.back().VtxOffset);
+        return static_cast<ImDrawIdx>(m_list.VtxBuffer.Size - 1 - first);
+    }
+
+    auto triangle(ImDrawIdx a, ImDrawIdx b, ImDrawIdx c) -> void {
+        m_list.IdxBuffer.push_back(a);
+        m_list.IdxBuffer.push_back(b);
+        m_list.IdxBuffer.push_back(c);
+        m_list.CmdBuffer.back().ElemCount += 3;
+    }
+
+    auto quad(float x0, float y0, float x1, float y1, ImVec2 uv0, ImVec2 uv1, ImU32 color)
+        -> void {
+        const ImDrawIdx a = vertex(ImVec2(x0, y0), uv0, color);
+        const ImDrawIdx b = vertex(ImVec2(x1, y0), ImVec2(uv1.x, uv0.y), color);
+        const ImDrawIdx c = vertex(ImVec2(x1, y1), uv1, color);
+        const ImDrawIdx d = vertex(ImVec2(x0, y1), ImVec2(uv0.x, uv1.y), color);
+        triangle(a, b, c);
+        triangle(a, c, d);
+    }
+
+    auto rect(float x0, float y0, float x1, float y1, ImU32 color) -> void {
+        quad(x0, y0, x1, y1, m_white, m_white, color);
+    }
+
+    // Filled like ImDrawList::AddConvexPolyFilled() with anti-aliasing: a fan inside,
+    // and a one pixel fringe that fades to transparent.
+    auto circle(float cx, float cy, float radius, ImU32 color, int segments = 24)
+        -> void {
+        const ImU32 transparent = color & 0x00ffffff;
+        ImDrawIdx first = 0;
+        for (int i = 0; i < segments; i++) {
+            const float angle = 6.2831853f * static_cast<float>(i) / segments;
+            const float dx = std::cos(angle);
+            const float dy = std::sin(angle);
+            const float in = radius - 0.5f;
+            const float out = radius + 0.5f;
+            const ImDrawIdx inner =
+                vertex(ImVec2(cx + dx * in, cy + dy * in), m_white, color);
+            vertex(ImVec2(cx + dx * out, cy + dy * out), m_white, transparent);
+            if (i == 0)
+                first = inner;
+        }
+        for (int i = 2; i < segments; i++)
+            triangle(first, static_cast<ImDrawIdx>(first + (i - 1) * 2),
+                     static_cast<ImDrawIdx>(first + i * 2));
+        for (int i0 = segments - 1, i1 = 0; i1 < segments; i0 = i1++) {
+            const auto in0 = static_cast<ImDrawIdx>(first + i0 * 2);
+            const auto in1 = static_cast<ImDrawIdx>(first + i1 * 2);
+            triangle(in1, in0, static_cast<ImDrawIdx>(in0 + 1));
+            triangle(static_cast<ImDrawIdx>(in0 + 1), static_cast<ImDrawIdx>(in1 + 1),
+                     in1);
+        }
+    }
+
+    // One pixel anti-aliased line like ImDrawList::AddPolyline(): opaque along the
+    // middle, transparent one pixel to either side.
+    auto line(ImVec2 from, ImVec2 to, ImU32 color) -> void {
+        const ImU32 transparent = color & 0x00ffffff;
+        const float dx = to.x - from.x;
+        const float dy = to.y - from.y;
+        const float length = std::sqrt(dx * dx + dy * dy);
+        const ImVec2 normal(-dy / length, dx / length);
+        ImDrawIdx idx[2][3];
+        const ImVec2 ends[2] = {from, to};
+        for (int e = 0; e < 2; e++) {
+            const ImVec2 p = ends[e];
+            const ImVec2 left(p.x - normal.x, p.y - normal.y);
+            const ImVec2 right(p.x + normal.x, p.y + normal.y);
+            idx[e][0] = vertex(left, m_white, transparent);
+            idx[e][1] = vertex(p, m_white, color);
+            idx[e][2] = vertex(right, m_white, transparent);
+        }
+        for (int side = 0; side < 2; side++) {
+            triangle(idx[0][side], idx[0][side + 1], idx[1][side + 1]);
+            triangle(idx[0][side], idx[1][side + 1], idx[1][side]);
+        }
+    }
+
+    std::vector<uint8_t> m_atlas;
+    SoftTexture m_texture;
+    ImVec2 m_white;
+    ImDrawList m_list{nullptr};
+    ImDrawData m_data;
+};
+
+// Pixels where raster_blend_span() and raster_blend_row() give other bytes than
+// raster_blend_pixel() one pixel at a time. Rows of `frame` are the destination; every
+// alpha is tried, at offsets and lengths that leave the kernels a scalar tail.
+auto blend_mismatches(const std::vector<uint8_t> &frame, int width, int height)
+    -> std::pair<size_t, size_t> {
+    std::mt19937 rng(3);
+    std::vector<uint32_t> simd(width);
+    std::vector<uint32_t> reference(width);
+    std::vector<uint32_t> src(width);
+    auto load_row = [&](uint32_t a) {
+        const size_t y = a * 7919 % static_cast<uint32_t>(height);
+        const size_t row_bytes = static_cast<size_t>(width) * 4;
+        std::memcpy(simd.data(), frame.data() + y * row_bytes, row_bytes);
+        reference = simd;
+    };
+    auto differing = [&] {
+        size_t count = 0;
+        for (int i = 0; i < width; i++)
+            count += simd[i] != reference[i];
+        return count;
+    };
+
+    size_t span = 0;
+    size_t row = 0;
+    for (uint32_t a = 0; a < 256; a++) {
+        const int offset = static_cast<int>(a % 7);
+        const int count = width - offset - static_cast<int>(a % 5);
+        load_row(a);
+        const uint32_t color = (rng() & 0xffffff) | a << 24;
+        raster_blend_span(simd.data() + offset, count, color);
+        for (int i = 0; i < count; i++)
+            raster_blend_pixel(reference.data() + offset + i, color);
+        span += differing();
+
+        // transparent runs take the skip, opaque and partly covered pixels the blend
+        load_row(a);
+        for (auto &pixel : src) {
+            const uint32_t kind = rng() % 4;
+            const uint32_t alpha = kind == 0 ? 0 : kind == 1 ? 255 : rng() & 255;
+            pixel = (rng() & 0xffffff) | alpha << 24;
+        }
+        for (int i = 0; i + 8 <= width; i += 32)
+            std::fill_n(src.begin() + i, 8, a & 0xffffff);
+        raster_blend_row(simd.data() + offset, src.data(), count);
+        for (int i = 0; i < count; i++)
+            raster_blend_pixel(reference.data() + offset + i, src[i]);
+        row += differing();
+    }
+    return {span, row};
+}
+
+// SoftRasterizer on a SyntheticUi frame, with one thread and with all of them. The two
+// must give the same pixels, since the bands do not overlap. Returns false if they do
+// not, or if the SIMD blend kernels disagree with raster_blend_pixel().
+auto bench_raster(const FrameSize &size) -> bool {
+#if defined(KGP_RASTER_SSE2)
+    const char *kernels = "sse2";
+#elif defined(KGP_RASTER_NEON)
+    const char *kernels = "neon";
+#else
+    const char *kernels = "scalar";
+#endif
+    const SyntheticUi ui(size);
+    // make_solid_frame() color, which is what gui.cpp clears to
+    const uint32_t clear = 0xff998c73;
+    const size_t bytes = static_cast<size_t>(size.width) * size.height * 4;
+    std::vector<uint8_t> single_out(bytes);
+    std::vector<uint8_t> threaded_out(bytes);
+    SoftRasterizer single(1);
+    // at least a few bands in flight, even on one core
+    SoftRasterizer threaded(std::max(4u, std::thread::hardware_concurrency()));
+
+    double one = best_seconds([&] {
+        single.render(ui.draw_data(), single_out.data(), size.width, size.height, clear);
+    });
+    double all = best_seconds([&] {
+        threaded.render(ui.draw_data(), threaded_out.data(), size.width, size.height,
+                        clear);
+    });
+    const bool bands_match = single_out == threaded_out;
+    std::printf("cpu raster, synthetic frame (%d vertices, %d indices), %s blending\n",
+                ui.vertices(), ui.indices(), kernels);
+    std::printf("  1 thread %8.2f ms/frame   %u threads %8.2f ms/frame%s\n", one * 1e3,
+                threaded.threads(), all * 1e3, bands_match ? "" : "  OUTPUT MISMATCH");
+
+    const auto [span, row] = blend_mismatches(single_out, size.width, size.height);
+    std::printf("  pixels differing from raster_blend_pixel(): span %zu, row %zu%s\n",
+                span, row, span + row == 0 ? "" : "  OUTPUT MISMATCH");
+    return bands_match && span + row == 0;
+}
+
+auto selected(int argc, char **argv, std::string_view section) -> bool {
+    if (argc < 2)
+        return true;
+    for (int i = 1; i < argc; i++) {
+        if (section == argv[i])
+            return true;
+    }
+    return false;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bool failed = false;
+    for (const FrameSize &size : SIZES) {
+        std::printf("== %s (%dx%d px, RGBA)\n", size.name, size.width, size.height);
+        const auto grid =
+            make_grid_frame(size.width, size.height, size.cell_width, size.cell_height);
+        const auto noise = make_noise_frame(size.width, size.height);
+        const auto solid = make_solid_frame(size.width, size.height);
+
+        if (selected(argc, argv, "base64"))
+            bench_base64(noise);
+        if (selected(argc, argv, "send")) {
+            std::printf("kitty writer to /dev/null, noise frame\n");
+            bench_send(noise);
+        }
+        if (selected(argc, argv, "flip")) {
+            std::printf("row flip, noise frame\n");
+            bench_flip(noise, size.width, size.height);
+        }
+        if (selected(argc, argv, "zlib")) {
+            bench_zlib("grid", grid);
+            bench_zlib("noise", noise);
+            bench_zlib("solid", solid);
+        }
+        if (selected(argc, argv, "diff")) {
+            std::printf("frame diff\n");
+            bench_diff(size);
+        }
+        if (selected(argc, argv, "formats")) {
+            bench_formats("grid", grid);
+            bench_formats("noise", noise);
+        }
+        if (selected(argc, argv, "delta"))
+            bench_delta(size);
+        if (selected(argc, argv, "raster") && !bench_raster(size))
+            failed = true;
+    }
+    return failed ? 1 : 0;
+}
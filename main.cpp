@@ -14,6 +14,10 @@
 #include <GLES2/gl2.h>
 #endif
 
+// GL 3 entry points are exported by libGL on Linux; declare them instead of loading
+#ifndef __APPLE__
+#define GL_GLEXT_PROTOTYPES
+#endif
 #include <GLFW/glfw3.h> // Will drag system OpenGL headers
 #include <cstring>
 #include <iostream>
@@ -23,13 +27,11 @@
 #include <OpenGL/gl3.h>
 #else
 #include <GL/gl.h>
+#include <GL/glext.h>
 #endif
+#include "context.hpp"
 #include "kgp.hpp"
 
-static void glfw_error_callback(int error, const char *description) {
-    fprintf(stderr, "GLFW Error %d: %s\n", error, description);
-}
-
 // Shader sources
 const char *vertexShaderSource = R"(
     #version 150
@@ -51,34 +53,18 @@ int main(int, char **) {
 #ifdef USE_KITTY_PROTOCOL
     setup_terminal();
 
-    // Get terminal size
-    struct winsize sz;
-    ioctl(0, TIOCGWINSZ, &sz);
-    int display_w = 800;
-    int display_h = 600;
-
-    glfwSetErrorCallback(glfw_error_callback);
-    if (!glfwInit())
-        return 1;
+    // Render at the terminal's pixel size when it reports one
+    TerminalSize term = terminal_size();
+    int display_w = term.width > 0 ? term.width : 800;
+    int display_h = term.height > 0 ? term.height : 600;
 
-    // GL 3.2 + GLSL 150
-    const char *glsl_version = "#version 150";
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 2);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-
-    // Create an invisible window
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-    GLFWwindow *window =
-        glfwCreateWindow(display_w, display_h, "Hidden OpenGL Window", nullptr, nullptr);
-    if (window == nullptr) {
-        std::cerr << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
+    // GL 3.2 core context: a hidden GLFW window or surfaceless EGL (KGP_GL)
+    OffscreenContext context(gl_backend_from_env(), display_w, display_h);
+    if (!context) {
+        std::cerr << "Failed to create an OpenGL context" << std::endl;
         restore_terminal();
         return 1;
     }
-    glfwMakeContextCurrent(window);
 
     // Setup framebuffer
     GLuint fb, rb, tex;
@@ -105,7 +91,6 @@ int main(int, char **) {
     GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     if (status != GL_FRAMEBUFFER_COMPLETE) {
         std::cerr << "Framebuffer is not complete! Status: " << status << std::endl;
-        glfwTerminate();
         restore_terminal();
         return 1;
     }
@@ -177,6 +162,7 @@ int main(int, char **) {
     glVertexAttribPointer(posAttrib, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), 0);
 
     std::vector<unsigned char> pixelData(display_w * display_h * 4);
+    stbi_flip_vertically_on_write(1);
 
     // Debug: Print OpenGL info
     // std::cerr << "OpenGL Version: " << glGetString(GL_VERSION) << std::endl;
@@ -184,9 +170,12 @@ int main(int, char **) {
     // std::cerr << "OpenGL Renderer: " << glGetString(GL_RENDERER) << std::endl;
     // std::cerr << "Display size: " << display_w << "x" << display_h << std::endl;
 
+    // every frame replaces the last under the same image and placement id
+    KittyImage image;
+
     // Main loop
-    while (!glfwWindowShouldClose(window)) {
-        glfwPollEvents();
+    while (!context.should_close()) {
+        context.poll_events();
 
         // Bind our framebuffer
         glBindFramebuffer(GL_FRAMEBUFFER, fb);
@@ -210,29 +199,26 @@ int main(int, char **) {
         glReadPixels(0, 0, display_w, display_h, GL_RGBA, GL_UNSIGNED_BYTE,
                      pixelData.data());
 
-        // Flip the image vertically
-        std::vector<unsigned char> flippedData(display_w * display_h * 4);
-        for (int y = 0; y < display_h; y++) {
-            memcpy(&flippedData[y * display_w * 4],
-                   &pixelData[(display_h - 1 - y) * display_w * 4], display_w * 4);
-        }
-
-        // Debug: Save frame as PNG
+        // Debug: Save frame as PNG (stb flips the bottom-up rows while writing)
         static int frame_count = 0;
         std::string filename = "frame_" + std::to_string(frame_count++) + ".png";
-        stbi_write_png(filename.c_str(), display_w, display_h, 4, flippedData.data(),
+        stbi_write_png(filename.c_str(), display_w, display_h, 4, pixelData.data(),
                        display_w * 4);
 
-        // Send frame using kitty protocol
-        std::string cmd =
-            "a=T,f=32,s=" + std::to_string(display_w) + ",v=" + std::to_string(display_h);
-        kitty_send_command(cmd, flippedData.data(), flippedData.size());
+        // Send frame using kitty protocol, reading the GL rows bottom to top while
+        // encoding instead of flipping into a second buffer
+        std::string cmd = std::string(image.upload_keys()) +
+                          ",f=32,s=" + std::to_string(display_w) +
+                          ",v=" + std::to_string(display_h);
+        kitty_writer().send_bottom_up(cmd, pixelData.data(), display_w * 4, display_h);
 
         // Move cursor to top-left after sending frame
-        std::cout << CSI << "H" << std::flush;
+        kitty_writer().write_control(CSI "H");
+        kitty_writer().flush();
     }
 
     // Cleanup
+    image.remove();
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
     glDeleteProgram(shaderProgram);
@@ -241,9 +227,6 @@ int main(int, char **) {
     glDeleteFramebuffers(1, &fb);
     glDeleteRenderbuffers(1, &rb);
     glDeleteTextures(1, &tex);
-
-    glfwDestroyWindow(window);
-    glfwTerminate();
     restore_terminal();
 
 #endif
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <span>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Read-only memory mapping of a whole file. Pages are faulted in as the decoder reaches
+ * them, so nothing is copied up front and untouched parts of a large file never occupy
+ * memory.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const char *path) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Failed to open " << path << ": " << std::strerror(errno)
+                      << "\n";
+            return;
+        }
+        struct stat st = {};
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                              MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                m_data = static_cast<const uint8_t *>(data);
+                m_size = static_cast<size_t>(st.st_size);
+                // read front to back, once
+                madvise(data, m_size, MADV_SEQUENTIAL);
+            } else {
+                std::cerr << "Failed to map " << path << ": " << std::strerror(errno)
+                          << "\n";
+            }
+        } else {
+            std::cerr << "Empty or unreadable file: " << path << "\n";
+        }
+        close(fd); // the mapping keeps the file alive
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (m_data)
+            munmap(const_cast<uint8_t *>(m_data), m_size);
+    }
+
+    [[nodiscard]] auto bytes() const -> std::span<const uint8_t> {
+        return {m_data, m_size};
+    }
+
+    explicit operator bool() const {
+        return m_data != nullptr;
+    }
+
+private:
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+};
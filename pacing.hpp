@@ -0,0 +1,191 @@
+#pragma once
+
+#include "kgp.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <zlib.h>
+
+/*
+ * Acknowledgement driven frame pacing. The last command of every frame is sent with an
+ * image id and without `q=`, so the terminal answers `_Gi=...;OK` once it has processed
+ * the whole frame. The others carry `q=1`, which still lets errors through. Only replies
+ * for that image id count; the shared memory probe, the asset cache and other images get
+ * replies of their own. Only one frame is in flight at a time: ready() stays false from
+ * the moment a frame is submitted until it is acknowledged (or turns out to have nothing
+ * to send), so a slow terminal holds frames back here instead of piling them up in the
+ * pty.
+ *
+ * An OK always answers the last command. An error may answer any of them, so it only
+ * ends the frame once every command of it has failed; otherwise the last command's own
+ * reply still follows. If that was an error too, the frame ends at the timeout, without
+ * counting as lost since the terminal did reply.
+ *
+ * The round trip of each acknowledged frame feeds a smoothed latency. Above the budget
+ * the pacer first lowers the zlib level, then the frame rate, then the resolution scale;
+ * well below it, it restores them in the opposite order.
+ */
+class FramePacer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int MIN_LEVEL = 1;
+    static constexpr double MIN_INTERVAL = 1.0 / 60;
+    static constexpr double MAX_INTERVAL = 1.0 / 5;
+    static constexpr double MIN_SCALE = 0.5;
+    // a frame not acknowledged within this long counts as lost
+    static constexpr auto ACK_TIMEOUT = std::chrono::seconds(1);
+    // after this many lost frames in a row the terminal is assumed not to reply at all
+    static constexpr int MAX_LOST = 3;
+    // acknowledgements well under budget needed before stepping quality back up
+    static constexpr int GOOD_STREAK = 8;
+    static constexpr auto ADJUST_PERIOD = std::chrono::milliseconds(250);
+
+    // `image_id` is the KittyImage the frames go to, whose replies are the acks.
+    FramePacer(double budget_ms, int max_level, uint32_t image_id)
+        : m_image_id(image_id), m_budget_ms(budget_ms),
+          m_max_level(max_level == Z_DEFAULT_COMPRESSION ? 6 : max_level),
+          m_level(m_max_level) {}
+
+    // Called by the render loop: true when a new frame may be submitted.
+    [[nodiscard]] auto ready() -> bool {
+        if (!m_enabled)
+            return true;
+        State state = m_state.load(std::memory_order_acquire);
+        if (state == State::Idle)
+            return true;
+        if (state == State::Sent && Clock::now() - sent_time() > ACK_TIMEOUT) {
+            if (m_frame_errors == 0 && ++m_lost >= MAX_LOST) {
+                std::cerr << "No graphics acknowledgements, pacing disabled\n";
+                m_enabled = false;
+            }
+            m_frame_errors = 0;
+            m_state.store(State::Idle, std::memory_order_release);
+            return true;
+        }
+        return false;
+    }
+
+    // The render loop handed a frame to the pipeline.
+    auto on_submit() -> void {
+        m_state.store(State::Queued, std::memory_order_release);
+    }
+
+    // The pipeline found nothing to send for the submitted frame.
+    auto on_skipped() -> void {
+        m_state.store(State::Idle, std::memory_order_release);
+    }
+
+    // The pipeline is about to write a frame of `commands` commands; called before the
+    // bytes hit the pty so an early acknowledgement always finds the frame marked as
+    // sent.
+    auto on_sent(size_t commands = 1) -> void {
+        auto ticks = Clock::now().time_since_epoch().count();
+        m_sent_ticks.store(ticks, std::memory_order_relaxed);
+        m_commands.store(commands, std::memory_order_relaxed);
+        m_state.store(State::Sent, std::memory_order_release);
+    }
+
+    // A graphics reply arrived on the tty. Reporting and recovering from errors is
+    // FramePipeline::on_reply()'s part.
+    auto on_reply(const KittyReply &reply) -> void {
+        if (reply.image_id != m_image_id ||
+            m_state.load(std::memory_order_acquire) != State::Sent)
+            return;
+        if (!reply.ok && ++m_frame_errors < m_commands.load(std::memory_order_relaxed))
+            return;
+
+        auto now = Clock::now();
+        double rtt_ms =
+            std::chrono::duration<double, std::milli>(now - sent_time()).count();
+        m_latency_ms = m_latency_ms == 0 ? rtt_ms : m_latency_ms * 0.875 + rtt_ms * 0.125;
+        m_lost = 0;
+        m_frame_errors = 0;
+        m_state.store(State::Idle, std::memory_order_release);
+        adapt(now);
+    }
+
+    // Seconds the render loop should wait between frames.
+    [[nodiscard]] auto frame_interval() const -> double {
+        return m_interval.load(std::memory_order_relaxed);
+    }
+
+    // zlib level the pipeline should compress with.
+    [[nodiscard]] auto zlib_level() const -> int {
+        return m_level.load(std::memory_order_relaxed);
+    }
+
+    // Fraction of the full resolution to render at.
+    [[nodiscard]] auto scale() const -> double {
+        return m_scale.load(std::memory_order_relaxed);
+    }
+
+    // Smoothed acknowledgement round trip in milliseconds, 0 before the first one.
+    [[nodiscard]] auto latency_ms() const -> double {
+        return m_latency_ms;
+    }
+
+private:
+    enum class State { Idle, Queued, Sent };
+
+    [[nodiscard]] auto sent_time() const -> Clock::time_point {
+        auto ticks = m_sent_ticks.load(std::memory_order_relaxed);
+        return Clock::time_point(Clock::duration(ticks));
+    }
+
+    auto adapt(Clock::time_point now) -> void {
+        if (now - m_last_adjust < ADJUST_PERIOD)
+            return;
+
+        if (m_latency_ms > m_budget_ms) {
+            m_good = 0;
+            m_last_adjust = now;
+            if (m_level > MIN_LEVEL)
+                m_level.store(m_level - 1, std::memory_order_relaxed);
+            else if (m_interval < MAX_INTERVAL)
+                m_interval.store(std::min(MAX_INTERVAL, m_interval * 1.25),
+                                 std::memory_order_relaxed);
+            else if (m_scale > MIN_SCALE)
+                m_scale.store(std::max(MIN_SCALE, m_scale - 0.125),
+                              std::memory_order_relaxed);
+        } else if (m_latency_ms < m_budget_ms / 2 && ++m_good >= GOOD_STREAK) {
+            m_good = 0;
+            m_last_adjust = now;
+            if (m_scale < 1)
+                m_scale.store(std::min(1.0, m_scale + 0.125), std::memory_order_relaxed);
+            else if (m_interval > MIN_INTERVAL)
+                m_interval.store(std::max(MIN_INTERVAL, m_interval / 1.25),
+                                 std::memory_order_relaxed);
+            else if (m_level < m_max_level)
+                m_level.store(m_level + 1, std::memory_order_relaxed);
+        }
+    }
+
+    uint32_t m_image_id;
+    double m_budget_ms;
+    int m_max_level;
+    bool m_enabled = true;
+    int m_lost = 0;
+    // error replies for the frame in flight
+    size_t m_frame_errors = 0;
+    int m_good = 0;
+    double m_latency_ms = 0;
+    Clock::time_point m_last_adjust;
+
+    std::atomic<State> m_state = State::Idle;
+    std::atomic<Clock::rep> m_sent_ticks = 0;
+    std::atomic<size_t> m_commands = 1;
+    std::atomic<int> m_level;
+    std::atomic<double> m_interval = MIN_INTERVAL;
+    std::atomic<double> m_scale = 1.0;
+};
+
+// KGP_LATENCY_MS sets the acknowledgement latency budget, 50 ms by default.
+inline auto latency_budget_from_env() -> double {
+    const char *env = std::getenv("KGP_LATENCY_MS");
+    double budget = env ? std::atof(env) : 0;
+    return budget > 0 ? budget : 50;
+}
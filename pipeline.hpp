@@ -0,0 +1,351 @@
+#pragma once
+
+#include "deflate.hpp"
+#include "delta.hpp"
+#include "diff.hpp"
+#include "format.hpp"
+#include "kgp.hpp"
+#include "pacing.hpp"
+#include "pool.hpp"
+#include "shm.hpp"
+#include "spsc.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <span>
+#include <string>
+#include <thread>
+
+/*
+ * Three stage frame pipeline. The GL thread only renders and reads back, then hands the
+ * pixels to submit(); a compress thread diffs and deflates them (or copies them into a
+ * shared memory segment) into packets of ready-made graphics commands; a write thread
+ * base64 encodes those into the tty. Buffers travel between stages through SPSC queues
+ * and come back through a second queue per stage. Frames, packets, their payloads and
+ * command strings are all sized up front, so the steady state never touches the heap.
+ *
+ * Frames are dropped on the way in, "latest wins": submit() drops the frame when every
+ * buffer is taken, and the compress thread skips to the newest queued frame. Packets are
+ * never dropped since the differ assumes the terminal saw every edit it produced; a slow
+ * tty stalls the compress thread instead, which in turn makes frames drop.
+ *
+ * The FramePacer is told when a submitted frame turned out empty and when it goes out,
+ * and supplies the zlib level. The last command of each frame asks for a reply, which
+ * the render loop feeds back to the pacer and to on_reply(). An error reply for the image
+ * (evicted, or an edit the terminal could not apply) means its copy no longer matches
+ * what the differ assumes, so the compress thread uploads the next frame whole.
+ *
+ * Frames go to the terminal as one KittyImage, owned by the caller so its ids outlive a
+ * pipeline. It is placed over `cols` x `rows` cells (c=, r=), so the terminal scales a
+ * frame rendered below the native resolution back up to fill them. A pipeline is tied
+ * to one frame size; on a resize the render loop destroys it and builds a new one.
+ *
+ * Frames arrive in the PixelFormat they are sent in. For PixelFormat::Palette the
+ * compress thread snaps them to the quantizer's palette before diffing. After the first
+ * upload, changed rectangles are encoded as the DeltaMode says; the delta modes send
+ * RGBA whatever the format.
+ */
+class FramePipeline {
+public:
+    static constexpr size_t FRAME_BUFFERS = 3;
+    static constexpr size_t PACKETS = 2;
+    static constexpr size_t COMMAND_CAPACITY = 128;
+
+    FramePipeline(int width, int height, int cols, int rows, Transport transport,
+                  PixelFormat format, DeltaMode delta, KittyImage &image,
+                  FramePacer &pacer, const PaletteQuantizer *quantizer = nullptr)
+        : m_width(width), m_height(height), m_cols(cols), m_rows(rows),
+          m_transport(transport), m_format(pixel_format_key(format)), m_delta(delta),
+          m_quantizer(format == PixelFormat::Palette ? quantizer : nullptr),
+          m_image(image), m_pacer(pacer),
+          m_frame_size(static_cast<size_t>(width) * height *
+                       pixel_format_channels(format)),
+          m_differ(width, height, pixel_format_channels(format), delta != DeltaMode::Off),
+          m_deflater(pacer.zlib_level()), m_frame_pool(FRAME_BUFFERS, m_frame_size),
+          m_payload_pool(PACKETS, payload_bound(std::max(m_frame_size, delta_size()))) {
+        // the differ starts from scratch, so the first frame is uploaded whole
+        m_image.invalidate();
+        m_deflater.reserve(std::max(m_frame_size, delta_size()));
+        if (m_delta == DeltaMode::Png)
+            m_png.reserve(static_cast<size_t>(width) * height, height);
+        m_shm_command.reserve(COMMAND_CAPACITY);
+        for (size_t i = 0; i < FRAME_BUFFERS; i++)
+            m_free_frames.push(m_frame_pool.buffer(i));
+        for (size_t i = 0; i < PACKETS; i++) {
+            Packet &packet = m_packet_storage[i];
+            packet.payload = m_payload_pool.buffer(i);
+            packet.capacity = m_payload_pool.size();
+            for (auto &command : packet.commands)
+                command.cmd.reserve(COMMAND_CAPACITY);
+            m_free_packets.push(&packet);
+        }
+
+        m_compress_thread = std::thread([this] { compress_stage(); });
+        m_write_thread = std::thread([this] { write_stage(); });
+    }
+
+    FramePipeline(const FramePipeline &) = delete;
+    FramePipeline &operator=(const FramePipeline &) = delete;
+
+    ~FramePipeline() {
+        // each stage drains its input, then closes its output
+        m_frames.close();
+        m_compress_thread.join();
+        m_write_thread.join();
+    }
+
+    // Called from the GL thread with a top-down frame in the pipeline's format. Copies it
+    // into a free buffer and returns right away; if the later stages still hold every
+    // buffer the frame is dropped and false returned.
+    auto submit(const uint8_t *pixels) -> bool {
+        uint8_t *frame = nullptr;
+        if (!m_free_frames.try_pop(frame)) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        std::memcpy(frame, pixels, m_frame_size);
+        m_pacer.on_submit();
+        m_frames.push(frame); // cannot fail, the queue holds every buffer
+        return true;
+    }
+
+    // Called from the render loop with every graphics reply. Errors are counted in
+    // pipeline_stats(); one for the image makes the next frame a full upload.
+    auto on_reply(const KittyReply &reply) -> void {
+        if (reply.ok)
+            return;
+        pipeline_stats().record_error(reply.message);
+        if (reply.image_id == m_image.id())
+            m_resync.store(true, std::memory_order_release);
+    }
+
+    // Set when a stage hit an unrecoverable error; the caller should stop.
+    [[nodiscard]] auto failed() const -> bool {
+        return m_failed.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] auto dropped() const -> uint64_t {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Command {
+        std::string cmd; // capacity reserved, assign() never reallocates
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    // Graphics commands of one frame, payloads packed back to back into a pooled buffer.
+    // The differ never returns more than MAX_RECTS rectangles.
+    struct Packet {
+        std::array<Command, FrameDiff::MAX_RECTS> commands;
+        size_t count = 0;
+        uint8_t *payload = nullptr;
+        size_t size = 0;
+        size_t capacity = 0;
+
+        auto clear() -> void {
+            count = 0;
+            size = 0;
+        }
+
+        auto add(std::string_view cmd, std::span<const uint8_t> data) -> void {
+            assert(count < commands.size() && size + data.size() <= capacity);
+            Command &command = commands[count++];
+            command.cmd.assign(cmd);
+            command.offset = size;
+            command.size = data.size();
+            std::memcpy(payload + size, data.data(), data.size());
+            size += data.size();
+        }
+    };
+
+    // Worst case payload of one frame: every block of every rectangle incompressible.
+    static auto payload_bound(size_t frame_size) -> size_t {
+        const size_t blocks =
+            frame_size / ParallelDeflate::BLOCK_SIZE + FrameDiff::MAX_RECTS + 1;
+        return blocks * ParallelDeflate::bound(ParallelDeflate::BLOCK_SIZE) +
+               FrameDiff::MAX_RECTS * PngEncoder::OVERHEAD;
+    }
+
+    // Most bytes the rectangles of one frame take as deltas: RGBA, plus a filter byte
+    // per row of every rectangle for Png. 0 with deltas off.
+    [[nodiscard]] auto delta_size() const -> size_t {
+        if (m_delta == DeltaMode::Off)
+            return 0;
+        return static_cast<size_t>(m_width) * m_height * 4 +
+               static_cast<size_t>(m_height) * FrameDiff::MAX_RECTS;
+    }
+
+    auto compress_stage() -> void {
+        uint8_t *frame = nullptr;
+        Packet *packet = nullptr; // kept across frames that produced nothing to send
+        while (m_frames.wait_pop(frame)) {
+            // latest wins: anything queued behind this frame is newer, skip to it
+            uint8_t *newer = nullptr;
+            while (m_frames.try_pop(newer)) {
+                m_free_frames.push(frame);
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                frame = newer;
+            }
+
+            if (!m_failed.load(std::memory_order_relaxed) &&
+                (packet || m_free_packets.wait_pop(packet))) {
+                packet->clear();
+                if (m_quantizer) {
+                    StageTimer timer(Stage::Quantize, m_frame_size);
+                    m_quantizer->apply(frame, static_cast<size_t>(m_width) * m_height);
+                }
+                m_deflater.set_level(m_pacer.zlib_level());
+                if (encode(frame, *packet)) {
+                    m_packets.push(packet);
+                    packet = nullptr;
+                } else {
+                    m_pacer.on_skipped();
+                }
+            }
+            m_free_frames.push(frame);
+        }
+        m_packets.close();
+    }
+
+    // Fills `packet` with the commands for one frame. Returns false when there is nothing
+    // to send.
+    auto encode(const uint8_t *pixels, Packet &packet) -> bool {
+        if (m_resync.exchange(false, std::memory_order_acquire)) {
+            m_image.invalidate();
+            m_differ.reset();
+        }
+        if (m_transport == Transport::SharedMemory) {
+            // nullptr means the terminal still holds both segments: drop this frame
+            uint8_t *segment = m_shm_pool.acquire(m_frame_size);
+            if (!segment)
+                return false;
+            std::memcpy(segment, pixels, m_frame_size);
+            // every frame is uploaded again under the same ids, replacing the last one
+            m_shm_command.assign(m_command,
+                                 format_command("%s,f=%d,s=%d,v=%d,c=%d,r=%d,C=1",
+                                                m_image.upload_keys(), m_format, m_width,
+                                                m_height, m_cols, m_rows));
+            auto name = m_shm_pool.command(m_shm_command);
+            packet.add(m_shm_command, name);
+            return true;
+        }
+
+        // Only the tiles that changed since the last frame are sent; an idle UI sends
+        // nothing at all
+        std::span<const FrameDiff::Rect> rects;
+        {
+            StageTimer timer(Stage::Diff, m_frame_size);
+            rects = m_differ.update(pixels);
+        }
+        // the terminal holds the previous frame once the first one was uploaded
+        const bool delta = m_delta != DeltaMode::Off && !m_image.needs_upload();
+        for (size_t i = 0; i < rects.size(); i++) {
+            const auto &rect = rects[i];
+            StageTimer timer(Stage::Compress);
+            auto region = delta ? m_differ.extract_delta(pixels, rect)
+                                : m_differ.extract(pixels, rect);
+
+            // Compress the pixel data using zlib, spread over the worker threads
+            auto compressed = m_delta == DeltaMode::Png && delta
+                                  ? m_png.encode(region, rect.w, rect.h, m_deflater)
+                                  : m_deflater.compress(region.data(), region.size());
+            timer.set_bytes(region.size(), compressed.size());
+            if (compressed.empty()) {
+                std::cerr << "Failed to compress pixel data" << std::endl;
+                m_failed.store(true, std::memory_order_release);
+                return false;
+            }
+
+            // only the last command of the frame is acknowledged; q=1 lets errors out
+            const char *quiet = i + 1 == rects.size() ? "" : ",q=1";
+            size_t length;
+            if (m_image.needs_upload()) {
+                // a=T (transmit+display) the full frame once under the image's ids
+                length = format_command("%s%s,o=z,f=%d,s=%d,v=%d,c=%d,r=%d,C=1",
+                                        m_image.upload_keys(), quiet, m_format, m_width,
+                                        m_height, m_cols, m_rows);
+            } else if (delta) {
+                // blend what changed onto the root frame, the rest is transparent
+                length = format_command("%s%s,%s,x=%d,y=%d,s=%d,v=%d",
+                                        m_image.blend_keys(), quiet,
+                                        m_delta == DeltaMode::Png ? "f=100" : "o=z,f=32",
+                                        rect.x, rect.y, rect.w, rect.h);
+            } else {
+                // then edit the root frame (r=1) in place, replacing (X=1) the rect
+                length = format_command("%s%s,o=z,f=%d,x=%d,y=%d,s=%d,v=%d",
+                                        m_image.edit_keys(), quiet, m_format, rect.x,
+                                        rect.y, rect.w, rect.h);
+            }
+            packet.add({m_command, length}, compressed);
+        }
+        return !rects.empty();
+    }
+
+    // snprintf into m_command, returns the length
+    template <typename... Args>
+    auto format_command(const char *format, Args... args) -> size_t {
+        int length = std::snprintf(m_command, sizeof(m_command), format, args...);
+        assert(length > 0 && static_cast<size_t>(length) < sizeof(m_command));
+        return static_cast<size_t>(length);
+    }
+
+    auto write_stage() -> void {
+        KittyWriter &writer = kitty_writer();
+        Packet *packet = nullptr;
+        while (m_packets.wait_pop(packet)) {
+            m_pacer.on_sent(packet->count);
+            for (size_t i = 0; i < packet->count; i++) {
+                const Command &command = packet->commands[i];
+                writer.send(command.cmd, packet->payload + command.offset, command.size);
+            }
+            m_free_packets.push(packet);
+
+            // Move cursor back to top-left after each frame
+            writer.write_control(CSI "H");
+            writer.flush(); // one flush per frame
+        }
+    }
+
+    int m_width;
+    int m_height;
+    int m_cols;
+    int m_rows;
+    Transport m_transport;
+    int m_format; // f= key
+    DeltaMode m_delta;
+    const PaletteQuantizer *m_quantizer;
+    KittyImage &m_image;
+    FramePacer &m_pacer;
+    size_t m_frame_size;
+
+    // compress stage state
+    FrameDiff m_differ;
+    ParallelDeflate m_deflater;
+    PngEncoder m_png;
+    ShmPool m_shm_pool;
+    char m_command[COMMAND_CAPACITY];
+    std::string m_shm_command;
+
+    FramePool m_frame_pool;
+    FramePool m_payload_pool;
+    std::array<Packet, PACKETS> m_packet_storage;
+    // GL thread -> compress -> GL thread
+    SpscQueue<uint8_t *, 4> m_frames;
+    SpscQueue<uint8_t *, 4> m_free_frames;
+    // compress -> write -> compress
+    SpscQueue<Packet *, 4> m_packets;
+    SpscQueue<Packet *, 4> m_free_packets;
+
+    std::atomic<bool> m_failed = false;
+    std::atomic<bool> m_resync = false; // render loop -> compress: upload the next frame
+    std::atomic<uint64_t> m_dropped = 0;
+    std::thread m_compress_thread;
+    std::thread m_write_thread;
+};
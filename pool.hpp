@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+
+/*
+ * Fixed set of page aligned frame sized buffers, allocated once at startup and only
+ * reallocated by resize(). Page alignment keeps memcpy/SIMD loads on whole cache lines
+ * and lets the kernel hand the buffers straight to writev/mmap without bouncing.
+ */
+class FramePool {
+public:
+    FramePool(size_t count, size_t size) : m_buffers(count) {
+        resize(size);
+    }
+
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    ~FramePool() {
+        release();
+    }
+
+    // Reallocates every buffer for frames of `size` bytes; previous contents are lost.
+    // Not safe while any buffer is in use.
+    auto resize(size_t size) -> void {
+        release();
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t rounded = (size + page - 1) / page * page;
+        for (auto &buffer : m_buffers) {
+            buffer = static_cast<uint8_t *>(std::aligned_alloc(page, rounded));
+            if (!buffer) {
+                std::cerr << "Failed to allocate " << rounded << " byte frame buffer\n";
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        m_size = size;
+    }
+
+    [[nodiscard]] auto buffer(size_t index) const -> uint8_t * {
+        return m_buffers[index];
+    }
+
+    [[nodiscard]] auto count() const -> size_t {
+        return m_buffers.size();
+    }
+
+    [[nodiscard]] auto size() const -> size_t {
+        return m_size;
+    }
+
+private:
+    auto release() -> void {
+        for (auto &buffer : m_buffers) {
+            std::free(buffer);
+            buffer = nullptr;
+        }
+    }
+
+    std::vector<uint8_t *> m_buffers;
+    size_t m_size = 0;
+};
+
+// Number of operator new calls so far. Only counted in builds configured with
+// KGP_COUNT_ALLOCATIONS, which replace the global allocation functions in gui.cpp.
+inline std::atomic<uint64_t> g_heap_allocations = 0;
+
+inline auto heap_allocations() -> uint64_t {
+    return g_heap_allocations.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,654 @@
+#pragma once
+
+#include "imgui.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#if defined(__SSE2__)
+#define KGP_RASTER_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define KGP_RASTER_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * Renders ImDrawData on the CPU, straight into a top-down RGBA buffer. Without a GPU the
+ * OpenGL path has llvmpipe rasterize the frame, then reads every pixel back and flips
+ * it; this skips the GL context, the readback and the flip altogether.
+ *
+ * The frame is cut into horizontal bands that a pool of worker threads render
+ * independently: each walks all draw commands clipped to its band, so no two threads
+ * touch the same pixel. Most of an ImGui frame is axis-aligned quads (rectangles and
+ * glyphs), drawn as spans without edge functions; solid spans are blended 4 pixels at a
+ * time with SSE2 or NEON. Everything else goes through a half-space triangle rasterizer
+ * with the same fill convention as GL, so shared edges are drawn exactly once.
+ *
+ * Blending matches the ImGui OpenGL backend: color = vertex color * texel (bilinear,
+ * clamped), src-alpha over an opaque destination that stays opaque. Results differ from
+ * GL by rounding only. Draw callbacks are skipped, they expect a GL state.
+ *
+ * Textures are SoftTexture pointers passed as ImTextureID, the font atlas included.
+ */
+enum class Renderer { OpenGL, Soft };
+
+[[nodiscard]] inline auto renderer_name(Renderer renderer) -> const char * {
+    return renderer == Renderer::Soft ? "cpu" : "gl";
+}
+
+// KGP_RENDERER=gl|cpu, OpenGL by default.
+inline auto renderer_from_env() -> Renderer {
+    const char *env = std::getenv("KGP_RENDERER");
+    if (!env)
+        return Renderer::OpenGL;
+    if (std::string_view(env) == "cpu")
+        return Renderer::Soft;
+    if (std::string_view(env) != "gl")
+        std::cerr << "Unknown KGP_RENDERER " << env << ", using gl\n";
+    return Renderer::OpenGL;
+}
+
+// RGBA texture the rasterizer samples. Its address is the ImTextureID.
+struct SoftTexture {
+    const uint8_t *rgba = nullptr;
+    int width = 0;
+    int height = 0;
+
+    [[nodiscard]] auto id() const -> ImTextureID {
+        return (ImTextureID)(intptr_t)this;
+    }
+};
+
+// x / 255 rounded to nearest, exact for x <= 255 * 255.
+inline auto raster_div255(uint32_t x) -> uint32_t {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Channel-wise product of two RGBA colors (ImU32, R in the low byte).
+inline auto raster_modulate(uint32_t a, uint32_t b) -> uint32_t {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        out |= raster_div255(((a >> shift) & 255) * ((b >> shift) & 255)) << shift;
+    return out;
+}
+
+// Blends `color` over one pixel: rgb with src-alpha, alpha with one-minus-src-alpha.
+inline auto raster_blend_pixel(uint32_t *dst, uint32_t color) -> void {
+    const uint32_t a = color >> 24;
+    if (a == 0)
+        return;
+    if (a == 255) {
+        *dst = color;
+        return;
+    }
+    const uint32_t inv = 255 - a;
+    const uint32_t d = *dst;
+    uint32_t out = raster_div255(255 * a + (d >> 24) * inv) << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+        out |= raster_div255(((color >> shift) & 255) * a + ((d >> shift) & 255) * inv)
+               << shift;
+    }
+    *dst = out;
+}
+
+// Blends one `color` over `count` pixels, 4 at a time where SIMD is available. Gives the
+// same bytes as raster_blend_pixel().
+inline auto raster_blend_span(uint32_t *dst, int count, uint32_t color) -> void {
+    const uint32_t a = color >> 24;
+    if (a == 0 || count <= 0)
+        return;
+    if (a == 255) {
+        std::fill_n(dst, count, color);
+        return;
+    }
+    int i = 0;
+#ifdef KGP_RASTER_SSE2
+    // 16-bit lanes: src * a + dst * (255 - a) + 128 never exceeds 65535
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_255 = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    const __m128i src = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(color)), zero);
+    const __m128i alpha = _mm_set1_epi16(static_cast<short>(a));
+    const __m128i src_term = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_or_si128(src, alpha_255), alpha), _mm_set1_epi16(128));
+    const __m128i factor = _mm_set1_epi16(static_cast<short>(255 - a));
+    auto blend = [&](__m128i d) {
+        d = _mm_add_epi16(_mm_mullo_epi16(d, factor), src_term);
+        return _mm_srli_epi16(_mm_add_epi16(d, _mm_srli_epi16(d, 8)), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+        auto *p = reinterpret_cast<__m128i *>(dst + i);
+        const __m128i d = _mm_loadu_si128(p);
+        _mm_storeu_si128(p, _mm_packus_epi16(blend(_mm_unpacklo_epi8(d, zero)),
+                                             blend(_mm_unpackhi_epi8(d, zero))));
+    }
+#endif
+#ifdef KGP_RASTER_NEON
+    const uint8x8_t src = vorr_u8(vreinterpret_u8_u32(vdup_n_u32(color)),
+                                  vreinterpret_u8_u32(vdup_n_u32(0xff000000u)));
+    const uint16x8_t src_term =
+        vaddq_u16(vmull_u8(src, vdup_n_u8(static_cast<uint8_t>(a))), vdupq_n_u16(128));
+    const uint8x8_t factor = vdup_n_u8(static_cast<uint8_t>(255 - a));
+    auto blend = [&](uint8x8_t d) {
+        const uint16x8_t x = vmlal_u8(src_term, d, factor);
+        return vshrn_n_u16(vsraq_n_u16(x, x, 8), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+        auto *p = reinterpret_cast<uint8_t *>(dst + i);
+        const uint8x16_t d = vld1q_u8(p);
+        vst1q_u8(p, vcombine_u8(blend(vget_low_u8(d)), blend(vget_high_u8(d))));
+    }
+#endif
+    for (; i < count; i++)
+        raster_blend_pixel(dst + i, color);
+}
+
+// Blends `count` pixels of `src` over `dst`, each with its own alpha. Same bytes as
+// raster_blend_pixel() for each; 4 pixels that are all transparent are skipped.
+inline auto raster_blend_row(uint32_t *dst, const uint32_t *src, int count) -> void {
+    int i = 0;
+#ifdef KGP_RASTER_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_255 = _mm_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255);
+    const __m128i all_255 = _mm_set1_epi16(255);
+    const __m128i bias = _mm_set1_epi16(128);
+    auto blend = [&](__m128i s, __m128i d) {
+        __m128i a = _mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3));
+        a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128i x = _mm_mullo_epi16(_mm_or_si128(s, alpha_255), a);
+        x = _mm_add_epi16(x, _mm_mullo_epi16(d, _mm_sub_epi16(all_255, a)));
+        x = _mm_add_epi16(x, bias);
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+        const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(s, 24), zero)) == 0xffff)
+            continue;
+        auto *p = reinterpret_cast<__m128i *>(dst + i);
+        const __m128i d = _mm_loadu_si128(p);
+        const __m128i lo = blend(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+        const __m128i hi = blend(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128(p, _mm_packus_epi16(lo, hi));
+    }
+#endif
+#ifdef KGP_RASTER_NEON
+    const uint8_t alpha_lanes[8] = {3, 3, 3, 3, 7, 7, 7, 7};
+    const uint8x8_t alpha_index = vld1_u8(alpha_lanes);
+    const uint8x8_t alpha_255 = vreinterpret_u8_u32(vdup_n_u32(0xff000000u));
+    const uint16x8_t bias = vdupq_n_u16(128);
+    auto blend = [&](uint8x8_t s, uint8x8_t d) {
+        const uint8x8_t a = vtbl1_u8(s, alpha_index);
+        uint16x8_t x = vmlal_u8(vmull_u8(vorr_u8(s, alpha_255), a), d, vmvn_u8(a));
+        x = vaddq_u16(x, bias);
+        return vshrn_n_u16(vsraq_n_u16(x, x, 8), 8);
+    };
+    for (; i + 4 <= count; i += 4) {
+        const uint32x4_t s = vld1q_u32(src + i);
+        if (vmaxvq_u32(vshrq_n_u32(s, 24)) == 0)
+            continue;
+        auto *p = reinterpret_cast<uint8_t *>(dst + i);
+        const uint8x16_t d = vld1q_u8(p);
+        const uint8x16_t s8 = vreinterpretq_u8_u32(s);
+        vst1q_u8(p, vcombine_u8(blend(vget_low_u8(s8), vget_low_u8(d)),
+                                blend(vget_high_u8(s8), vget_high_u8(d))));
+    }
+#endif
+    for (; i < count; i++)
+        raster_blend_pixel(dst + i, src[i]);
+}
+
+// (1 - w) * a + w * b per channel, with w in 256ths. Two channels per multiply.
+inline auto raster_lerp(uint32_t a, uint32_t b, uint32_t w) -> uint32_t {
+    const uint32_t rb = ((a & 0xff00ff) * (256 - w) + (b & 0xff00ff) * w) >> 8;
+    const uint32_t ga = ((a >> 8) & 0xff00ff) * (256 - w) + ((b >> 8) & 0xff00ff) * w;
+    return (rb & 0xff00ff) | (ga & 0xff00ff00);
+}
+
+class SoftRasterizer {
+public:
+    static constexpr int MIN_BAND_HEIGHT = 16;
+
+    explicit SoftRasterizer(unsigned threads = 0) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        // the calling thread works too
+        m_scratch.resize(threads);
+        for (unsigned i = 1; i < threads; i++)
+            m_workers.emplace_back([this, i] { worker(i); });
+    }
+
+    SoftRasterizer(const SoftRasterizer &) = delete;
+    SoftRasterizer &operator=(const SoftRasterizer &) = delete;
+
+    ~SoftRasterizer() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (auto &worker : m_workers)
+            worker.join();
+    }
+
+    // Clears `pixels` (`width` x `height` RGBA, top-down) to `clear`, or copies
+    // `background` (same size) into it, and renders `draw_data` over it. Returns once
+    // every band is done.
+    auto render(const ImDrawData *draw_data, uint8_t *pixels, int width, int height,
+                uint32_t clear, const uint8_t *background = nullptr) -> void {
+        m_draw_data = draw_data;
+        m_pixels = reinterpret_cast<uint32_t *>(pixels);
+        m_background = reinterpret_cast<const uint32_t *>(background);
+        m_width = width;
+        m_height = height;
+        m_clear = clear;
+        for (auto &scratch : m_scratch) {
+            if (scratch.colors.size() < static_cast<size_t>(width)) {
+                scratch.colors.resize(width);
+                scratch.columns.resize(width);
+            }
+        }
+        // a few bands per thread so one busy band does not hold up the frame
+        const int bands = static_cast<int>(m_scratch.size()) * 4;
+        m_band_height = std::max(MIN_BAND_HEIGHT, (height + bands - 1) / bands);
+        m_band_count = (height + m_band_height - 1) / m_band_height;
+
+        if (m_workers.empty() || m_band_count <= 1) {
+            m_next_band = 0;
+            run_bands(m_scratch[0]);
+            return;
+        }
+        {
+            std::lock_guard lock(m_mutex);
+            m_next_band = 0;
+            m_done_workers = 0;
+            m_generation++;
+        }
+        m_start.notify_all();
+        run_bands(m_scratch[0]);
+        {
+            std::unique_lock lock(m_mutex);
+            m_finished.wait(lock, [this] { return m_done_workers == m_workers.size(); });
+        }
+    }
+
+    [[nodiscard]] auto threads() const -> unsigned {
+        return static_cast<unsigned>(m_scratch.size());
+    }
+
+private:
+    // Pixel rectangle [x0, x1) x [y0, y1) a command may touch: its scissor within a band.
+    struct Clip {
+        int x0, y0, x1, y1;
+    };
+
+    struct Point {
+        float x, y;
+    };
+
+    // The two texels and the weight between them a pixel column samples.
+    struct Column {
+        int x0, x1;
+        uint32_t weight;
+    };
+
+    // Per thread row buffers, sized for the widest frame so bands never allocate.
+    struct Scratch {
+        std::vector<uint32_t> colors;
+        std::vector<Column> columns;
+    };
+
+    auto worker(unsigned index) -> void {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop)
+                    return;
+                seen = m_generation;
+            }
+            run_bands(m_scratch[index]);
+            {
+                std::lock_guard lock(m_mutex);
+                m_done_workers++;
+            }
+            m_finished.notify_one();
+        }
+    }
+
+    auto run_bands(Scratch &scratch) -> void {
+        for (;;) {
+            const int band = m_next_band.fetch_add(1);
+            if (band >= m_band_count)
+                return;
+            const int y0 = band * m_band_height;
+            render_band(scratch, y0, std::min(m_height, y0 + m_band_height));
+        }
+    }
+
+    auto render_band(Scratch &scratch, int y0, int y1) -> void {
+        if (m_background)
+            std::copy(m_background + static_cast<size_t>(y0) * m_width,
+                      m_background + static_cast<size_t>(y1) * m_width, row(y0));
+        else
+            std::fill(row(y0), row(y1), m_clear);
+        const ImDrawData *data = m_draw_data;
+        if (!data)
+            return;
+        const ImVec2 offset = data->DisplayPos;
+        const ImVec2 scale = data->FramebufferScale;
+        for (int n = 0; n < data->CmdListsCount; n++) {
+            const ImDrawList *list = data->CmdLists[n];
+            for (const ImDrawCmd &cmd : list->CmdBuffer) {
+                if (cmd.UserCallback)
+                    continue;
+                // same truncation as the glScissor() call of the GL backend, which
+                // takes the origin and the size
+                const float min_x = (cmd.ClipRect.x - offset.x) * scale.x;
+                const float min_y = (cmd.ClipRect.y - offset.y) * scale.y;
+                const float max_x = (cmd.ClipRect.z - offset.x) * scale.x;
+                const float max_y = (cmd.ClipRect.w - offset.y) * scale.y;
+                if (max_x <= min_x || max_y <= min_y)
+                    continue;
+                const int bottom = static_cast<int>(m_height - max_y);
+                const Clip clip = {
+                    std::max(0, static_cast<int>(min_x)),
+                    std::max(y0, m_height - bottom - static_cast<int>(max_y - min_y)),
+                    std::min(m_width, static_cast<int>(min_x) +
+                                          static_cast<int>(max_x - min_x)),
+                    std::min(y1, m_height - bottom)};
+                if (clip.x0 >= clip.x1 || clip.y0 >= clip.y1)
+                    continue;
+                draw_elements(scratch, list->VtxBuffer.Data + cmd.VtxOffset,
+                              list->IdxBuffer.Data + cmd.IdxOffset, cmd.ElemCount,
+                              texture_of(cmd.GetTexID()), clip);
+            }
+        }
+    }
+
+    static auto texture_of(ImTextureID id) -> const SoftTexture * {
+        return (const SoftTexture *)(intptr_t)id;
+    }
+
+    // Frame buffer position, snapped to the 1/256 pixel grid GPUs rasterize on so
+    // coverage ties break the same way.
+    auto to_pixels(const ImVec2 &pos) const -> Point {
+        const ImVec2 offset = m_draw_data->DisplayPos;
+        const ImVec2 scale = m_draw_data->FramebufferScale;
+        return {std::nearbyint((pos.x - offset.x) * scale.x * 256.0f) / 256.0f,
+                std::nearbyint((pos.y - offset.y) * scale.y * 256.0f) / 256.0f};
+    }
+
+    auto draw_elements(Scratch &scratch, const ImDrawVert *vtx, const ImDrawIdx *idx,
+                       unsigned count, const SoftTexture *texture, const Clip &clip)
+        -> void {
+        for (unsigned i = 0; i + 3 <= count;) {
+            // AddRect/PrimRectUV emit quads as (a, b, c), (a, c, d)
+            if (i + 6 <= count && idx[i + 3] == idx[i] && idx[i + 4] == idx[i + 2] &&
+                draw_quad(scratch, vtx[idx[i]], vtx[idx[i + 1]], vtx[idx[i + 2]],
+                          vtx[idx[i + 5]], texture, clip)) {
+                i += 6;
+                continue;
+            }
+            draw_triangle(scratch, vtx[idx[i]], vtx[idx[i + 1]], vtx[idx[i + 2]],
+                          texture, clip);
+            i += 3;
+        }
+    }
+
+    // Axis-aligned quad of one color with the texture mapped along the axes. Returns
+    // false, drawing nothing, if a-b-c-d is anything else.
+    auto draw_quad(Scratch &scratch, const ImDrawVert &a, const ImDrawVert &b,
+                   const ImDrawVert &c, const ImDrawVert &d, const SoftTexture *texture,
+                   const Clip &clip) -> bool {
+        if (a.col != b.col || a.col != c.col || a.col != d.col)
+            return false;
+        auto corner = [](const ImDrawVert &v, const ImDrawVert &x, const ImDrawVert &y) {
+            return v.pos.x == x.pos.x && v.pos.y == y.pos.y && v.uv.x == x.uv.x &&
+                   v.uv.y == y.uv.y;
+        };
+        if (!(corner(b, c, a) && corner(d, a, c)) &&
+            !(corner(b, a, c) && corner(d, c, a)))
+            return false;
+
+        const Point pa = to_pixels(a.pos);
+        const Point pc = to_pixels(c.pos);
+        // pixels whose centers lie inside, left and top edges included
+        const int x0 = std::max(clip.x0, pixel_edge(std::min(pa.x, pc.x)));
+        const int x1 = std::min(clip.x1, pixel_edge(std::max(pa.x, pc.x)));
+        const int y0 = std::max(clip.y0, pixel_edge(std::min(pa.y, pc.y)));
+        const int y1 = std::min(clip.y1, pixel_edge(std::max(pa.y, pc.y)));
+        if (x0 >= x1 || y0 >= y1)
+            return true;
+
+        if (!texture || (a.uv.x == c.uv.x && a.uv.y == c.uv.y)) {
+            const uint32_t color =
+                raster_modulate(a.col, sample(texture, a.uv.x, a.uv.y));
+            for (int y = y0; y < y1; y++)
+                raster_blend_span(row(y) + x0, x1 - x0, color);
+            return true;
+        }
+
+        // glyphs: the texel columns are the same on every row
+        const float du = (c.uv.x - a.uv.x) / (pc.x - pa.x);
+        const float dv = (c.uv.y - a.uv.y) / (pc.y - pa.y);
+        Column *columns = scratch.columns.data();
+        for (int x = x0; x < x1; x++)
+            columns[x - x0] = texel_pair(a.uv.x + (x + 0.5f - pa.x) * du, texture->width);
+        uint32_t *colors = scratch.colors.data();
+        const bool white = a.col == 0xffffffff;
+        for (int y = y0; y < y1; y++) {
+            const Column rows =
+                texel_pair(a.uv.y + (y + 0.5f - pa.y) * dv, texture->height);
+            const auto *top = reinterpret_cast<const uint32_t *>(texture->rgba) +
+                              static_cast<size_t>(rows.x0) * texture->width;
+            const auto *bottom = reinterpret_cast<const uint32_t *>(texture->rgba) +
+                                 static_cast<size_t>(rows.x1) * texture->width;
+            for (int i = 0; i < x1 - x0; i++) {
+                const Column &column = columns[i];
+                const uint32_t texel = raster_lerp(
+                    raster_lerp(top[column.x0], top[column.x1], column.weight),
+                    raster_lerp(bottom[column.x0], bottom[column.x1], column.weight),
+                    rows.weight);
+                colors[i] = white || (texel >> 24) == 0 ? texel
+                                                        : raster_modulate(a.col, texel);
+            }
+            raster_blend_row(row(y) + x0, colors, x1 - x0);
+        }
+        return true;
+    }
+
+    auto draw_triangle(Scratch &scratch, const ImDrawVert &v0, const ImDrawVert &v1,
+                       const ImDrawVert &v2, const SoftTexture *texture, const Clip &clip)
+        -> void {
+        const ImDrawVert *v[3] = {&v0, &v1, &v2};
+        Point p[3] = {to_pixels(v0.pos), to_pixels(v1.pos), to_pixels(v2.pos)};
+        const int y0 = std::max(clip.y0, pixel_edge(std::min({p[0].y, p[1].y, p[2].y})));
+        const int y1 = std::min(clip.y1, pixel_edge(std::max({p[0].y, p[1].y, p[2].y})));
+        if (y0 >= y1) // mostly another band's triangle
+            return;
+        const int x0 = std::max(clip.x0, pixel_edge(std::min({p[0].x, p[1].x, p[2].x})));
+        const int x1 = std::min(clip.x1, pixel_edge(std::max({p[0].x, p[1].x, p[2].x})));
+        if (x0 >= x1)
+            return;
+        float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) -
+                     (p[1].y - p[0].y) * (p[2].x - p[0].x);
+        if (area == 0)
+            return;
+        if (area < 0) { // ImGui does not cull, wind every triangle the same way
+            std::swap(v[1], v[2]);
+            std::swap(p[1], p[2]);
+            area = -area;
+        }
+
+        // edge i faces vertex i: E(x, y) = A (x - from.x) + B (y - from.y), positive
+        // inside; its value over the area is the barycentric weight of vertex i
+        struct Edge {
+            float a, b;
+            Point from;
+        } edges[3];
+        for (int i = 0; i < 3; i++) {
+            const Point &from = p[(i + 1) % 3];
+            const Point &to = p[(i + 2) % 3];
+            edges[i] = {from.y - to.y, to.x - from.x, from};
+        }
+
+        const bool flat_color = v0.col == v1.col && v0.col == v2.col;
+        const bool flat_uv = !texture || (v0.uv.x == v1.uv.x && v0.uv.x == v2.uv.x &&
+                                          v0.uv.y == v1.uv.y && v0.uv.y == v2.uv.y);
+        const uint32_t flat_texel = flat_uv ? sample(texture, v0.uv.x, v0.uv.y) : 0;
+        if (flat_uv && (flat_texel >> 24) == 0)
+            return;
+
+        // attribute = base + w1 * (attr1 - attr0) + w2 * (attr2 - attr0): r, g, b, a in
+        // 16.16 fixed point, then u, v
+        float base[6], delta1[6], delta2[6], step[6];
+        attributes(*v[0], base);
+        attributes(*v[1], delta1);
+        attributes(*v[2], delta2);
+        for (int k = 0; k < 6; k++) {
+            delta1[k] -= base[k];
+            delta2[k] -= base[k];
+            step[k] = (edges[1].a * delta1[k] + edges[2].a * delta2[k]) / area;
+        }
+        int32_t color_step[4];
+        for (int k = 0; k < 4; k++)
+            color_step[k] = static_cast<int32_t>(step[k]);
+
+        uint32_t *colors = scratch.colors.data();
+        for (int y = y0; y < y1; y++) {
+            const float py = y + 0.5f;
+            int lo = x0;
+            int hi = x1;
+            for (const Edge &edge : edges) {
+                // E at the center of pixel x is k + A x. Pixels on an edge belong to
+                // the triangle whose edge has A > 0, or A == 0 and B > 0, like GL's
+                // top-left rule: exactly one of two triangles sharing it.
+                const float k =
+                    edge.a * (0.5f - edge.from.x) + edge.b * (py - edge.from.y);
+                if (edge.a == 0) {
+                    if (k < 0 || (k == 0 && edge.b < 0))
+                        hi = lo;
+                    continue;
+                }
+                const float t = std::clamp(-k / edge.a, -1e6f, 1e6f);
+                if (edge.a > 0) // E >= 0 from x = t on
+                    lo = std::max(lo, static_cast<int>(std::ceil(t)));
+                else // E > 0 below x = t
+                    hi = std::min(hi, static_cast<int>(std::ceil(t)));
+            }
+            if (lo >= hi)
+                continue;
+
+            uint32_t *out = row(y);
+            if (flat_color && flat_uv) {
+                raster_blend_span(out + lo, hi - lo, raster_modulate(v0.col, flat_texel));
+                continue;
+            }
+            const float px = lo + 0.5f;
+            const float w1 = (edges[1].a * (px - edges[1].from.x) +
+                              edges[1].b * (py - edges[1].from.y)) /
+                             area;
+            const float w2 = (edges[2].a * (px - edges[2].from.x) +
+                              edges[2].b * (py - edges[2].from.y)) /
+                             area;
+            float attr[6];
+            for (int k = 0; k < 6; k++)
+                attr[k] = base[k] + w1 * delta1[k] + w2 * delta2[k];
+            int32_t r = static_cast<int32_t>(attr[0]), g = static_cast<int32_t>(attr[1]);
+            int32_t b = static_cast<int32_t>(attr[2]), a = static_cast<int32_t>(attr[3]);
+            for (int i = 0; i < hi - lo; i++) {
+                colors[i] =
+                    channel(r) | channel(g) << 8 | channel(b) << 16 | channel(a) << 24;
+                r += color_step[0];
+                g += color_step[1];
+                b += color_step[2];
+                a += color_step[3];
+            }
+            if (!flat_uv) {
+                for (int i = 0; i < hi - lo; i++) {
+                    const uint32_t texel = sample(texture, attr[4] + i * step[4],
+                                                  attr[5] + i * step[5]);
+                    colors[i] = raster_modulate(colors[i], texel);
+                }
+            } else if (flat_texel != 0xffffffff) {
+                for (int i = 0; i < hi - lo; i++)
+                    colors[i] = raster_modulate(colors[i], flat_texel);
+            }
+            raster_blend_row(out + lo, colors, hi - lo);
+        }
+    }
+
+    // First pixel whose center is at or right of (below) `edge`.
+    static auto pixel_edge(float edge) -> int {
+        return static_cast<int>(std::ceil(std::clamp(edge, -1e6f, 1e6f) - 0.5f));
+    }
+
+    // r, g, b, a (0 - 255 in 16.16 fixed point), u, v
+    static auto attributes(const ImDrawVert &vert, float *out) -> void {
+        for (int k = 0; k < 4; k++)
+            out[k] = static_cast<float>((vert.col >> (8 * k)) & 255) * 65536.0f;
+        out[4] = vert.uv.x;
+        out[5] = vert.uv.y;
+    }
+
+    // 16.16 fixed point channel to 0 - 255, rounded
+    static auto channel(int32_t value) -> uint32_t {
+        return static_cast<uint32_t>(std::clamp((value + 32768) >> 16, 0, 255));
+    }
+
+    // Texels left and right of (above and below) texture coordinate `uv` on an axis of
+    // `size` texels, clamped to the edge, for bilinear filtering.
+    static auto texel_pair(float uv, int size) -> Column {
+        const float position = uv * static_cast<float>(size) - 0.5f;
+        const float floor = std::floor(position);
+        const auto weight = static_cast<uint32_t>((position - floor) * 256.0f + 0.5f);
+        const int x0 = static_cast<int>(std::clamp(floor, 0.0f, size - 1.0f));
+        const int x1 = std::min(static_cast<int>(std::max(floor + 1, 0.0f)), size - 1);
+        return {x0, x1, std::min(weight, 256u)};
+    }
+
+    // Bilinear sample, opaque white without a texture.
+    static auto sample(const SoftTexture *texture, float u, float v) -> uint32_t {
+        if (!texture || !texture->rgba)
+            return 0xffffffff;
+        const Column x = texel_pair(u, texture->width);
+        const Column y = texel_pair(v, texture->height);
+        const auto *texels = reinterpret_cast<const uint32_t *>(texture->rgba);
+        const uint32_t *top = texels + static_cast<size_t>(y.x0) * texture->width;
+        const uint32_t *bottom = texels + static_cast<size_t>(y.x1) * texture->width;
+        return raster_lerp(raster_lerp(top[x.x0], top[x.x1], x.weight),
+                           raster_lerp(bottom[x.x0], bottom[x.x1], x.weight), y.weight);
+    }
+
+    auto row(int y) const -> uint32_t * {
+        return m_pixels + static_cast<size_t>(y) * m_width;
+    }
+
+    const ImDrawData *m_draw_data = nullptr;
+    uint32_t *m_pixels = nullptr;
+    const uint32_t *m_background = nullptr;
+    int m_width = 0;
+    int m_height = 0;
+    uint32_t m_clear = 0;
+    int m_band_height = MIN_BAND_HEIGHT;
+    int m_band_count = 0;
+
+    std::vector<Scratch> m_scratch; // one per thread, [0] for the caller
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_finished;
+    uint64_t m_generation = 0;
+    size_t m_done_workers = 0;
+    bool m_stop = false;
+    std::atomic<int> m_next_band = 0;
+};
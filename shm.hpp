@@ -0,0 +1,217 @@
+#pragma once
+
+#include "kgp.hpp"
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <span>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Shared memory transmission (`t=s`) for terminals running on the same machine. Pixel
+ * data is written into a POSIX shared memory object and only its name travels through the
+ * pty, base64 encoded, so a frame costs a few dozen bytes of tty traffic instead of tens
+ * of MB.
+ *
+ * The terminal unlinks the object once it has read it, which is how we know a segment has
+ * been released: a slot whose name no longer resolves can be refilled. Two slots let us
+ * fill the next frame while the terminal is still reading the previous one. A terminal
+ * that rejects a segment never unlinks it, so a slot still held after RELEASE_TIMEOUT is
+ * unlinked and reused by us.
+ */
+class ShmPool {
+public:
+    static constexpr int SLOTS = 2;
+    // a local terminal reads a segment within a frame or two; one held this long was
+    // rejected (or the terminal is gone) and will not be released
+    static constexpr auto RELEASE_TIMEOUT = std::chrono::seconds(1);
+
+    ShmPool() {
+        // pools are rebuilt on a resize while the terminal may still be reading the old
+        // one's segments, so every pool gets names of its own
+        static std::atomic<unsigned> pools = 0;
+        const unsigned pool = pools.fetch_add(1, std::memory_order_relaxed);
+        for (int i = 0; i < SLOTS; i++) {
+            // macOS limits names to 31 characters
+            std::snprintf(m_slots[i].name, sizeof(m_slots[i].name), "/kgp-%d-%u-%d",
+                          static_cast<int>(getpid()), pool % 100000, i);
+        }
+    }
+
+    ShmPool(const ShmPool &) = delete;
+    ShmPool &operator=(const ShmPool &) = delete;
+
+    // Segments that were sent belong to the terminal, which unlinks them once read (the
+    // last one may not have been read yet); only filled but unsent ones are unlinked.
+    ~ShmPool() {
+        for (auto &slot : m_slots) {
+            if (slot.addr && !slot.in_flight)
+                shm_unlink(slot.name);
+            unmap(slot);
+        }
+    }
+
+    // Returns a writable mapping of `size` bytes for the next frame, or nullptr when
+    // every segment is still waiting for the terminal (the caller should skip the frame).
+    auto acquire(size_t size) -> uint8_t * {
+        for (int n = 0; n < SLOTS; n++) {
+            int index = (m_next + n) % SLOTS;
+            Slot &slot = m_slots[index];
+            if (slot.in_flight && !released(slot)) {
+                if (Clock::now() - slot.sent < RELEASE_TIMEOUT)
+                    continue;
+                // rejected: the terminal will never unlink it, so we do
+                shm_unlink(slot.name);
+            }
+
+            unmap(slot);
+            int fd = shm_open(slot.name, O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0 && errno == EEXIST) {
+                // stale object from an earlier run with the same pid
+                shm_unlink(slot.name);
+                fd = shm_open(slot.name, O_CREAT | O_EXCL | O_RDWR, 0600);
+            }
+            if (fd < 0) {
+                std::cerr << "shm_open failed: " << std::strerror(errno) << "\n";
+                return nullptr;
+            }
+            if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+                std::cerr << "ftruncate failed: " << std::strerror(errno) << "\n";
+                close(fd);
+                shm_unlink(slot.name);
+                return nullptr;
+            }
+            void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if (addr == MAP_FAILED) {
+                std::cerr << "mmap failed: " << std::strerror(errno) << "\n";
+                shm_unlink(slot.name);
+                return nullptr;
+            }
+
+            slot.addr = static_cast<uint8_t *>(addr);
+            slot.size = size;
+            m_current = index;
+            m_next = (index + 1) % SLOTS;
+            return slot.addr;
+        }
+        return nullptr;
+    }
+
+    // Queues the command for the segment returned by the last acquire(). `cmd` gets the
+    // `t=s` and `S=` keys appended and the segment name as payload.
+    auto send(KittyWriter &writer, std::string &cmd) -> void {
+        auto name = command(cmd);
+        writer.send(cmd, name.data(), name.size());
+    }
+
+    // Same as send() for callers that queue the command themselves: appends the keys to
+    // `cmd` and returns the payload, which stays valid until the slot is reused.
+    auto command(std::string &cmd) -> std::span<const uint8_t> {
+        Slot &slot = m_slots[m_current];
+        cmd += ",t=s,S="; // appended piecewise, a reserved `cmd` never reallocates
+        cmd += std::to_string(slot.size);
+        slot.in_flight = true;
+        slot.sent = Clock::now();
+        return {reinterpret_cast<const uint8_t *>(slot.name), std::strlen(slot.name)};
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        char name[32] = {};
+        uint8_t *addr = nullptr;
+        size_t size = 0;
+        bool in_flight = false;
+        Clock::time_point sent;
+    };
+
+    // Whether the terminal unlinked the segment. A lookup that fails for another reason
+    // (out of file descriptors, say) tells nothing either way; the slot then counts as
+    // held until RELEASE_TIMEOUT, reporting the error once.
+    auto released(const Slot &slot) -> bool {
+        int fd = shm_open(slot.name, O_RDONLY, 0);
+        if (fd >= 0) {
+            close(fd);
+            return false;
+        }
+        if (errno == ENOENT)
+            return true;
+        if (!m_lookup_failed) {
+            std::cerr << "shm_open " << slot.name << " failed: " << std::strerror(errno)
+                      << "\n";
+            m_lookup_failed = true;
+        }
+        return false;
+    }
+
+    static auto unmap(Slot &slot) -> void {
+        if (slot.addr)
+            munmap(slot.addr, slot.size);
+        slot.addr = nullptr;
+        slot.in_flight = false;
+    }
+
+    Slot m_slots[SLOTS];
+    int m_current = 0;
+    int m_next = 0;
+    bool m_lookup_failed = false;
+};
+
+// Asks the terminal to load a 1x1 image from shared memory with `a=q` (which is never
+// stored). Returns true only if it answers OK, i.e. it shares our shm namespace.
+inline auto kitty_probe_shm(int timeout_ms = 500) -> bool {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/kgp-probe-%d", static_cast<int>(getpid()));
+
+    // a 1x1 RGB image, zero filled by ftruncate (macOS does not allow write() on shm)
+    int fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+    if (fd < 0)
+        return false;
+    bool sized = ftruncate(fd, 3) == 0;
+    close(fd);
+    if (!sized) {
+        shm_unlink(name);
+        return false;
+    }
+
+    KittyWriter &writer = kitty_writer();
+    writer.send("i=31,s=1,v=1,a=q,t=s,f=24", reinterpret_cast<const uint8_t *>(name),
+                std::strlen(name));
+    writer.write_control(CSI "c"); // primary device attributes, answered by everyone
+    writer.flush();
+
+    // Read up to the device attributes answer, which comes after the graphics reply if
+    // there is one, so whatever the reply was, none of it is left for the input reader.
+    KittyReply reply;
+    bool ok = false;
+    for (;;) {
+        const auto event = kitty_reply_reader().read(timeout_ms, reply);
+        if (event != KittyReplyReader::Event::Reply)
+            break; // device attributes, or a terminal that answers neither
+        if (reply.image_id == 31)
+            ok = reply.ok;
+    }
+    shm_unlink(name); // no-op if the terminal already did
+    return ok;
+}
+
+enum class Transport { Direct, SharedMemory };
+
+// KGP_TRANSPORT=direct|shm forces a medium; by default shared memory is used when the
+// terminal accepts the probe and direct transmission otherwise (e.g. over SSH).
+inline auto kitty_choose_transport() -> Transport {
+    const char *forced = std::getenv("KGP_TRANSPORT");
+    std::string_view choice = forced ? forced : "auto";
+    if (choice == "direct")
+        return Transport::Direct;
+    if (choice == "shm")
+        return Transport::SharedMemory;
+    return kitty_probe_shm() ? Transport::SharedMemory : Transport::Direct;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/*
+ * Bounded single-producer single-consumer ring. push/try_pop never block or take a
+ * lock; wait_pop parks the consumer on an atomic counter that every push and close()
+ * bumps. N must be a power of two, one slot stays empty to tell full from empty.
+ */
+template <typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Returns false when the queue is full.
+    auto push(T value) -> bool {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        const size_t next = (head + 1) & (N - 1);
+        if (next == m_tail.load(std::memory_order_acquire))
+            return false;
+        m_items[head] = std::move(value);
+        m_head.store(next, std::memory_order_release);
+        signal();
+        return true;
+    }
+
+    auto try_pop(T &value) -> bool {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+            return false;
+        value = std::move(m_items[tail]);
+        m_tail.store((tail + 1) & (N - 1), std::memory_order_release);
+        return true;
+    }
+
+    // Blocks until an item arrives. Returns false once the queue is closed and drained.
+    auto wait_pop(T &value) -> bool {
+        for (;;) {
+            const uint32_t seen = m_signal.load(std::memory_order_acquire);
+            if (try_pop(value))
+                return true;
+            if (m_closed.load(std::memory_order_acquire))
+                return try_pop(value);
+            m_signal.wait(seen, std::memory_order_acquire);
+        }
+    }
+
+    auto close() -> void {
+        m_closed.store(true, std::memory_order_release);
+        signal();
+    }
+
+private:
+    auto signal() -> void {
+        m_signal.fetch_add(1, std::memory_order_release);
+        m_signal.notify_one();
+    }
+
+    std::array<T, N> m_items{};
+    // producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+    alignas(64) std::atomic<uint32_t> m_signal = 0;
+    std::atomic<bool> m_closed = false;
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string_view>
+
+/*
+ * Per stage timings of the frame path. Each stage is timed with a StageTimer around the
+ * code it covers and recorded into a lock-free histogram, together with the bytes it
+ * consumed and produced. Recording is a handful of relaxed atomic adds, and nothing at
+ * all while collection is off (the default): the timer then never reads the clock.
+ *
+ * KGP_STATS=<path> turns collection on from the start and writes the stages to `path`
+ * on exit, as CSV if it ends in ".csv" and as JSON otherwise. The GUI also shows them in
+ * an overlay (F12), which turns collection on as well.
+ *
+ * Error replies from the terminal are counted whether or not collection is on, since the
+ * tty they would otherwise be printed to is the one being drawn on.
+ */
+enum class Stage {
+    Startup,  // creating the GL context, the ImGui backends and the frame buffers
+    Frame,    // GUI::frame(): ImGui widgets and GL draw calls
+    Flip,     // the vertical flip blit before a readback
+    Readback, // waiting for a readback and mapping it
+    Quantize, // palette quantization
+    Diff,     // finding the tiles that changed
+    Compress, // extracting and deflating one rectangle
+    Encode,   // base64 encoding one chunk
+    Write,    // writev() to the tty
+    Count,
+};
+
+[[nodiscard]] inline auto stage_name(Stage stage) -> const char * {
+    switch (stage) {
+    case Stage::Startup: return "startup";
+    case Stage::Frame: return "frame";
+    case Stage::Flip: return "flip";
+    case Stage::Readback: return "readback";
+    case Stage::Quantize: return "quantize";
+    case Stage::Diff: return "diff";
+    case Stage::Compress: return "compress";
+    case Stage::Encode: return "encode";
+    case Stage::Write: return "write";
+    case Stage::Count: break;
+    }
+    return "?";
+}
+
+/*
+ * Latency histogram any number of threads record into without locks. Buckets are exact
+ * below 16 ns and log-linear above, 8 per power of two, so a percentile is accurate to
+ * within 1/8 of its value.
+ */
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKETS = 8;
+    static constexpr int LINEAR = 2 * SUB_BUCKETS;
+    static constexpr int BUCKETS = LINEAR + (64 - 4) * SUB_BUCKETS;
+
+    auto record(uint64_t ns) -> void {
+        m_buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_total.fetch_add(ns, std::memory_order_relaxed);
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (ns > max &&
+               !m_max.compare_exchange_weak(max, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    [[nodiscard]] auto count() const -> uint64_t {
+        return m_count.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto total() const -> uint64_t {
+        return m_total.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto max() const -> uint64_t {
+        return m_max.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the `p` quantile (0 - 1), 0 if nothing was
+    // recorded. Concurrent records may or may not be included.
+    [[nodiscard]] auto percentile(double p) const -> uint64_t {
+        const uint64_t count = this->count();
+        if (count == 0)
+            return 0;
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(p * count + 0.5));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(bucket_upper(i), max());
+        }
+        return max();
+    }
+
+private:
+    static auto bucket(uint64_t ns) -> int {
+        if (ns < LINEAR)
+            return static_cast<int>(ns);
+        const int exponent = std::bit_width(ns) - 1; // 4 and up
+        const int sub = static_cast<int>(ns >> (exponent - 3)) & (SUB_BUCKETS - 1);
+        return LINEAR + (exponent - 4) * SUB_BUCKETS + sub;
+    }
+
+    static auto bucket_upper(int index) -> uint64_t {
+        if (index < LINEAR)
+            return static_cast<uint64_t>(index);
+        const int exponent = (index - LINEAR) / SUB_BUCKETS + 4;
+        const uint64_t sub = (index - LINEAR) % SUB_BUCKETS;
+        const uint64_t width = uint64_t{1} << (exponent - 3);
+        return (SUB_BUCKETS + sub) * width + (width - 1);
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> m_buckets = {};
+    std::atomic<uint64_t> m_count = 0;
+    std::atomic<uint64_t> m_total = 0;
+    std::atomic<uint64_t> m_max = 0;
+};
+
+struct StageStats {
+    LatencyHistogram latency;
+    std::atomic<uint64_t> bytes_in = 0;
+    std::atomic<uint64_t> bytes_out = 0;
+};
+
+class PipelineStats {
+public:
+    static constexpr size_t STAGES = static_cast<size_t>(Stage::Count);
+
+    [[nodiscard]] auto enabled() const -> bool {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    auto enable() -> void {
+        m_enabled.store(true, std::memory_order_relaxed);
+    }
+
+    auto record(Stage stage, uint64_t ns, uint64_t bytes_in, uint64_t bytes_out) -> void {
+        StageStats &stats = m_stages[static_cast<size_t>(stage)];
+        stats.latency.record(ns);
+        if (bytes_in)
+            stats.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+        if (bytes_out)
+            stats.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto stage(Stage stage) const -> const StageStats & {
+        return m_stages[static_cast<size_t>(stage)];
+    }
+
+    // Which GL backend rendered, so dumps of different runs can be told apart. Must
+    // outlive the stats (a string literal).
+    auto set_backend(const char *backend) -> void {
+        m_backend = backend;
+    }
+
+    [[nodiscard]] auto backend() const -> const char * {
+        return m_backend;
+    }
+
+    // A graphics command was answered with an error. Only called from the render loop,
+    // which is also the only reader of last_error().
+    auto record_error(std::string_view message) -> void {
+        m_errors.fetch_add(1, std::memory_order_relaxed);
+        // kept printable and JSON safe
+        const size_t n = std::min(message.size(), sizeof(m_last_error) - 1);
+        for (size_t i = 0; i < n; i++) {
+            const char c = message[i];
+            m_last_error[i] = c < 0x20 || c == '"' || c == '\\' ? '?' : c;
+        }
+        m_last_error[n] = 0;
+    }
+
+    [[nodiscard]] auto errors() const -> uint64_t {
+        return m_errors.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] auto last_error() const -> const char * {
+        return m_last_error;
+    }
+
+    auto write_json(FILE *out) const -> void {
+        std::fprintf(out,
+                     "{\n  \"backend\": \"%s\",\n  \"errors\": %llu,\n"
+                     "  \"last_error\": \"%s\",\n  \"stages\": [",
+                     m_backend, ull(errors()), m_last_error);
+        for (size_t i = 0; i < STAGES; i++) {
+            const StageStats &stats = m_stages[i];
+            std::fprintf(out,
+                         "%s\n    {\"stage\": \"%s\", \"count\": %llu, "
+                         "\"total_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+                         "\"max_ns\": %llu, "
+                         "\"bytes_in\": %llu, \"bytes_out\": %llu}",
+                         i ? "," : "", stage_name(static_cast<Stage>(i)),
+                         ull(stats.latency.count()), ull(stats.latency.total()),
+                         ull(stats.latency.percentile(0.5)),
+                         ull(stats.latency.percentile(0.99)), ull(stats.latency.max()),
+                         ull(stats.bytes_in.load()), ull(stats.bytes_out.load()));
+        }
+        std::fprintf(out, "\n  ]\n}\n");
+    }
+
+    auto write_csv(FILE *out) const -> void {
+        std::fprintf(out,
+                     "stage,count,total_ns,p50_ns,p99_ns,max_ns,bytes_in,bytes_out\n");
+        for (size_t i = 0; i < STAGES; i++) {
+            const StageStats &stats = m_stages[i];
+            std::fprintf(out, "%s,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                         stage_name(static_cast<Stage>(i)), ull(stats.latency.count()),
+                         ull(stats.latency.total()), ull(stats.latency.percentile(0.5)),
+                         ull(stats.latency.percentile(0.99)), ull(stats.latency.max()),
+                         ull(stats.bytes_in.load()), ull(stats.bytes_out.load()));
+        }
+        // error replies as one more row, counted and nothing else
+        std::fprintf(out, "errors,%llu,0,0,0,0,0,0\n", ull(errors()));
+    }
+
+    // Writes CSV if `path` ends in ".csv", JSON otherwise.
+    auto dump(const char *path) const -> bool {
+        FILE *out = std::fopen(path, "w");
+        if (!out) {
+            std::cerr << "Failed to write stats to " << path << ": "
+                      << std::strerror(errno) << "\n";
+            return false;
+        }
+        const size_t length = std::strlen(path);
+        if (length >= 4 && std::strcmp(path + length - 4, ".csv") == 0)
+            write_csv(out);
+        else
+            write_json(out);
+        return std::fclose(out) == 0;
+    }
+
+private:
+    static auto ull(uint64_t value) -> unsigned long long {
+        return value;
+    }
+
+    std::atomic<bool> m_enabled = false;
+    const char *m_backend = "none";
+    std::atomic<uint64_t> m_errors = 0;
+    char m_last_error[128] = {};
+    std::array<StageStats, STAGES> m_stages;
+};
+
+// Stats shared by every stage of the process.
+inline auto pipeline_stats() -> PipelineStats & {
+    static PipelineStats stats;
+    return stats;
+}
+
+// Path from KGP_STATS, or nullptr. Turns collection on when set.
+inline auto stats_path_from_env() -> const char * {
+    const char *path = std::getenv("KGP_STATS");
+    if (!path || !*path)
+        return nullptr;
+    pipeline_stats().enable();
+    return path;
+}
+
+// Times its scope as one run of `stage`. Reads the clock only while stats are enabled.
+class StageTimer {
+public:
+    explicit StageTimer(Stage stage, uint64_t bytes_in = 0)
+        : m_stage(stage), m_bytes_in(bytes_in), m_running(pipeline_stats().enabled()) {
+        if (m_running)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    StageTimer(const StageTimer &) = delete;
+    StageTimer &operator=(const StageTimer &) = delete;
+
+    ~StageTimer() {
+        if (!m_running)
+            return;
+        const auto elapsed = std::chrono::steady_clock::now() - m_start;
+        pipeline_stats().record(
+            m_stage,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+            m_bytes_in, m_bytes_out);
+    }
+
+    auto set_bytes(uint64_t bytes_in, uint64_t bytes_out) -> void {
+        m_bytes_in = bytes_in;
+        m_bytes_out = bytes_out;
+    }
+
+    auto set_bytes_out(uint64_t bytes_out) -> void {
+        m_bytes_out = bytes_out;
+    }
+
+private:
+    Stage m_stage;
+    uint64_t m_bytes_in;
+    uint64_t m_bytes_out = 0;
+    bool m_running;
+    std::chrono::steady_clock::time_point m_start;
+};
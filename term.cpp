@@ -0,0 +1,259 @@
+#include "fake_terminal.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __APPLE__
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+/*
+ * Headless stand-in for a kitty graphics terminal. Runs a command on a pty whose size
+ * includes pixels (so TIOCGWINSZ works as in kitty), hands everything it writes to a
+ * FakeTerminal and writes the replies back. At the end it reports the throughput, the
+ * frames per second, the decode cost and the ack latency.
+ *
+ * Usage: kgp_term [-g COLSxROWS] [-c WxH] [-t seconds] [-m hz] [-r kB/s] [-d out.ppm]
+ *                 command...
+ *
+ *   -g  terminal size in cells (80x24)
+ *   -c  cell size in pixels (10x20)
+ *   -t  stop the command with SIGINT after this many seconds; otherwise wait for it
+ *   -m  send this many mouse motion reports a second once the command asked for them,
+ *       sweeping the window, so an idle UI keeps drawing
+ *   -r  read at most this many kilobytes a second from the pty, like a slow link; the
+ *       command's writes block once the pty buffer is full
+ *   -d  write the last image as the terminal would show it to a PPM file at the end
+ *
+ * The command's environment is passed through, so e.g. KGP_TRANSPORT, KGP_DELTA or
+ * KGP_LATENCY_MS pick the mode under test. Exits with 1 if the command failed or any
+ * graphics command was answered with an error.
+ */
+namespace {
+
+constexpr size_t READ_SIZE = 1 << 20;
+// after SIGINT, how long the command gets to exit before SIGKILL
+constexpr auto EXIT_GRACE = std::chrono::seconds(2);
+
+auto usage(const char *name) -> int {
+    std::cerr << "Usage: " << name
+              << " [-g COLSxROWS] [-c WxH] [-t seconds] [-m hz] [-r kB/s] [-d out.ppm]"
+                 " command..."
+              << std::endl;
+    return 2;
+}
+
+auto parse_pair(const char *text, int &a, int &b) -> bool {
+    return std::sscanf(text, "%dx%d", &a, &b) == 2 && a > 0 && b > 0;
+}
+
+auto write_all(int fd, std::string_view data) -> void {
+    while (!data.empty()) {
+        ssize_t n = write(fd, data.data(), data.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return; // the command is gone
+        data.remove_prefix(static_cast<size_t>(n));
+    }
+}
+
+// Motion report number `index` (SGR, no button held), on an ellipse around the center of
+// a `width` x `height` area of cells or pixels.
+auto send_motion(int fd, uint64_t index, int width, int height) -> void {
+    const double angle = static_cast<double>(index) * 0.05;
+    const int x = 1 + static_cast<int>((0.5 + 0.4 * std::cos(angle)) * (width - 1));
+    const int y = 1 + static_cast<int>((0.5 + 0.4 * std::sin(angle)) * (height - 1));
+    char report[32];
+    int length = std::snprintf(report, sizeof(report), "\x1B[<35;%d;%dM", x, y);
+    write_all(fd, {report, static_cast<size_t>(length)});
+}
+
+auto ms(uint64_t ns) -> double {
+    return static_cast<double>(ns) / 1e6;
+}
+
+auto print_latency(const char *name, const LatencyHistogram &histogram) -> void {
+    std::printf("  %-9s p50 %8.2f ms  p99 %8.2f ms  max %8.2f ms  total %9.1f ms\n", name,
+                ms(histogram.percentile(0.5)), ms(histogram.percentile(0.99)),
+                ms(histogram.max()), ms(histogram.total()));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    FakeTerminal::Geometry geometry;
+    double seconds = 0;
+    double mouse_hz = 0;
+    double rate = 0; // bytes per second, 0 for unlimited
+    const char *dump_path = nullptr;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        const char *option = argv[arg];
+        if (std::strcmp(option, "--") == 0) {
+            arg++;
+            break;
+        }
+        if (arg + 1 >= argc || option[2] != 0)
+            return usage(argv[0]);
+        const char *value = argv[++arg];
+        bool ok = true;
+        switch (option[1]) {
+        case 'g': ok = parse_pair(value, geometry.cols, geometry.rows); break;
+        case 'c':
+            ok = parse_pair(value, geometry.cell_width, geometry.cell_height);
+            break;
+        case 't': ok = (seconds = std::atof(value)) > 0; break;
+        case 'm': ok = (mouse_hz = std::atof(value)) > 0; break;
+        case 'r': ok = (rate = std::atof(value) * 1000) > 0; break;
+        case 'd': dump_path = value; break;
+        default: ok = false;
+        }
+        if (!ok)
+            return usage(argv[0]);
+    }
+    if (arg >= argc)
+        return usage(argv[0]);
+
+    // raw, so nothing on the way is translated; the client sets its own modes anyway
+    termios raw = {};
+    cfmakeraw(&raw);
+    winsize size = {};
+    size.ws_col = static_cast<unsigned short>(geometry.cols);
+    size.ws_row = static_cast<unsigned short>(geometry.rows);
+    size.ws_xpixel = static_cast<unsigned short>(geometry.cols * geometry.cell_width);
+    size.ws_ypixel = static_cast<unsigned short>(geometry.rows * geometry.cell_height);
+
+    int master = -1;
+    const pid_t child = forkpty(&master, nullptr, &raw, &size);
+    if (child < 0) {
+        std::perror("forkpty");
+        return 1;
+    }
+    if (child == 0) {
+        execvp(argv[arg], argv + arg);
+        std::perror(argv[arg]);
+        _exit(127);
+    }
+
+    FakeTerminal terminal(geometry, [master](std::string_view reply) {
+        write_all(master, reply);
+    });
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    const Clock::duration mouse_gap =
+        mouse_hz > 0 ? std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double>(1.0 / mouse_hz))
+                     : Clock::duration::zero();
+    Clock::time_point next_mouse = start;
+    std::optional<Clock::time_point> interrupted;
+    uint64_t mouse_events = 0;
+    std::vector<char> buffer(READ_SIZE);
+    uint64_t received = 0;
+    // with -r, reads of 10 ms worth of bytes at a time
+    const size_t read_size =
+        rate > 0 ? std::clamp<size_t>(static_cast<size_t>(rate / 100), 1, READ_SIZE)
+                 : READ_SIZE;
+
+    for (;;) {
+        const Clock::time_point now = Clock::now();
+        if (seconds > 0 && !interrupted &&
+            now - start >= std::chrono::duration<double>(seconds)) {
+            kill(child, SIGINT);
+            interrupted = now;
+        }
+        if (interrupted && now - *interrupted > EXIT_GRACE)
+            kill(child, SIGKILL);
+
+        const bool moving = mouse_hz > 0 && !interrupted && terminal.mouse_motion();
+        if (moving && now >= next_mouse) {
+            const bool pixels = terminal.sgr_pixels();
+            send_motion(master, mouse_events++, pixels ? size.ws_xpixel : geometry.cols,
+                        pixels ? size.ws_ypixel : geometry.rows);
+            next_mouse = std::max(next_mouse + mouse_gap, now);
+        }
+
+        int timeout_ms = 100;
+        if (moving)
+            timeout_ms = static_cast<int>(std::clamp<int64_t>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(next_mouse - now)
+                    .count(),
+                0, 100));
+        if (rate > 0) {
+            // nothing more is read until the bytes so far have had their time on the link
+            const auto due = start + std::chrono::duration_cast<Clock::duration>(
+                                         std::chrono::duration<double>(received / rate));
+            if (now < due) {
+                const auto wait =
+                    std::chrono::ceil<std::chrono::milliseconds>(due - now).count();
+                poll(nullptr, 0, std::min(timeout_ms, static_cast<int>(wait)));
+                continue;
+            }
+        }
+        pollfd pfd = {master, POLLIN, 0};
+        const int ready = poll(&pfd, 1, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            std::perror("poll");
+            break;
+        }
+        if (ready <= 0)
+            continue;
+        const ssize_t n = read(master, buffer.data(), read_size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // EIO once the command and everything it started closed the pty
+        received += static_cast<uint64_t>(n);
+        terminal.feed(buffer.data(), static_cast<size_t>(n));
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    int status = 0;
+    waitpid(child, &status, 0);
+    close(master);
+
+    const FakeTerminal::Stats &stats = terminal.stats();
+    std::printf("%s ", argv[arg]);
+    if (WIFEXITED(status))
+        std::printf("exited with %d", WEXITSTATUS(status));
+    else if (WIFSIGNALED(status))
+        std::printf("killed by signal %d", WTERMSIG(status));
+    std::printf(" after %.2f s\n", elapsed);
+    std::printf("  read      %12llu bytes  %8.1f MB/s  (%llu in payloads)\n",
+                static_cast<unsigned long long>(stats.bytes), stats.bytes / elapsed / 1e6,
+                static_cast<unsigned long long>(stats.payload));
+    std::printf("  graphics  %12llu commands in %llu chunks, %llu frames  %6.1f fps\n",
+                static_cast<unsigned long long>(stats.commands),
+                static_cast<unsigned long long>(stats.chunks),
+                static_cast<unsigned long long>(stats.frames), stats.frames / elapsed);
+    std::printf("  errors    %12llu%s%s\n", static_cast<unsigned long long>(stats.errors),
+                stats.errors ? "  last: " : "", stats.last_error.c_str());
+    if (mouse_events)
+        std::printf("  mouse     %12llu motion reports\n",
+                    static_cast<unsigned long long>(mouse_events));
+    print_latency("decode", stats.decode);
+    print_latency("ack", stats.ack);
+
+    if (dump_path && !terminal.dump_ppm(dump_path))
+        std::cerr << "No image to write to " << dump_path << std::endl;
+
+    // after -t, exiting on the SIGINT (gui.cpp exits with 130) is how the run should end
+    const bool clean = WIFEXITED(status) && (WEXITSTATUS(status) == 0 || interrupted);
+    const bool stopped = interrupted && WIFSIGNALED(status) && WTERMSIG(status) == SIGINT;
+    return (clean || stopped) && stats.errors == 0 ? 0 : 1;
+}